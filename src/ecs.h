@@ -1,32 +1,257 @@
 #ifndef ECS_H
 #define ECS_H
 
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 size_t  ecs_world_create(void);
 void    ecs_world_destroy(size_t world_id);
 void    ecs_world_current_set(size_t world_id);
 size_t  ecs_world_current_get(void);
+size_t  ecs_world_clone(size_t world_id);
+
+typedef struct
+ecs_memory_stats
+{
+    size_t entities;   /* Entity table, component masks and child lists */
+    size_t components; /* Component columns and their row-to-entity arrays */
+    size_t maps;       /* Id and index hash tables, empty slots included */
+    size_t queries;    /* Query results and compiled signatures */
+    size_t other;      /* Resources, spatial and key indices, hierarchy buffers */
+    size_t total;
+} ecs_memory_stats;
+
+void    ecs_world_memory_stats(size_t world_id, ecs_memory_stats *stats);
+void    ecs_world_compact(size_t world_id);
+int     ecs_world_defragment(size_t world_id);
 
 size_t  ecs_entity_create(void);
 void    ecs_entity_destroy(size_t entity_id);
 
+/* Ids for entities created from worker threads. Reserve capacity on the main
+   thread first, then ecs_entity_reserve is lock-free and returns 0 once the
+   capacity is used up. Reserved entities exist after ecs_entity_reserved_flush
+   or ecs_update, attach components to them from there. */
+int     ecs_entity_reserve_capacity(size_t count);
+size_t  ecs_entity_reserve(void);
+void    ecs_entity_reserved_flush(void);
+
 size_t  ecs_component_register(size_t component_size);
 void    ecs_component_unregister(size_t component_id);
 
+/* Variable-size components store an ecs_blob per row, its bytes live in a
+   per-world slab allocator. Rows start empty and are sized with
+   ecs_entity_component_resize. The bytes go away with the component, when
+   it is detached or its entity destroyed, and are recycled by ecs_update.
+   So are the old bytes of a resize that moved them. */
+typedef struct
+ecs_blob
+{
+    void *data;
+    size_t size;
+} ecs_blob;
+
+size_t  ecs_component_register_variable(void);
+void   *ecs_entity_component_resize(size_t entity_id, size_t component_id, size_t size);
+
 void    ecs_entity_component_attach(size_t entity_id, size_t component_id);
 void    ecs_entity_component_detach(size_t entity_id, size_t component_id);
 
+int     ecs_entity_component_has(size_t entity_id, size_t component_id);
 void   *ecs_entity_component_get(size_t entity_id, size_t component_id);
+int     ecs_entity_component_modified(size_t entity_id, size_t component_id);
 void    ecs_update(void);
 
+/* Disabled entities and components keep their rows and values, queries skip
+   them and toggling moves nothing. ecs_component_disabled returns words with
+   a bit per row of ecs_component_data, set for the rows to skip, or 0 when
+   every row is enabled. */
+void    ecs_entity_enable(size_t entity_id, int enable);
+int     ecs_entity_enabled(size_t entity_id);
+void    ecs_entity_component_enable(size_t entity_id, size_t component_id, int enable);
+int     ecs_entity_component_enabled(size_t entity_id, size_t component_id);
+size_t *ecs_component_disabled(size_t component_id, size_t *words_count);
+
+/* Rows to visit when iterating the column of components_ids[0]: count
+   groups of num_components row indices, entry k being the row of
+   components_ids[k] in its ecs_component_data and 0 for tags. Disabled rows,
+   dead entities and entities missing or disabling one of the components are
+   left out. The first component must have data. The rows live in the
+   per-world arena and stay valid until ecs_update. */
+size_t *ecs_component_rows(const size_t *components_ids, size_t num_components, size_t *count);
+
+size_t  ecs_resource_register(size_t resource_size);
+void    ecs_resource_unregister(size_t resource_id);
+void   *ecs_resource_get(size_t resource_id);
+
+/* Event channels carry short-lived messages of one type without creating
+   entities. Any number of threads can write at once, each reservation is a
+   single atomic add, and ecs_event_reserve hands out several contiguous
+   slots to fill without further synchronization. Readers get the events of
+   the frame as one array, ecs_update clears the channel in O(1). Writes past
+   the capacity are dropped and the channel grows to fit at ecs_update; a
+   reservation that does not fit whole is dropped whole, so reads only ever
+   see reserved slots. */
+size_t  ecs_event_channel_register(size_t event_size, size_t capacity);
+void    ecs_event_channel_unregister(size_t channel_id);
+int     ecs_event_send(size_t channel_id, const void *event);
+void   *ecs_event_reserve(size_t channel_id, size_t count);
+void   *ecs_event_read(size_t channel_id, size_t *count);
+
+size_t  ecs_spatial_index_create(size_t component_id, size_t offset, size_t dimensions, float cell_size);
+void    ecs_spatial_index_destroy(size_t index_id);
+size_t *ecs_spatial_query_radius(size_t index_id, float x, float y, float z, float radius, size_t *count);
+size_t *ecs_spatial_query_aabb(size_t index_id,
+                               float min_x, float min_y, float min_z,
+                               float max_x, float max_y, float max_z,
+                               size_t *count);
+
+/* Hash index on key_size bytes at offset in a component. Keys are refreshed
+   on attach, detach, destroy and ecs_entity_component_modified, the bucket
+   table grows with the number of keys. Holders of a key stay indexed in
+   write order and ecs_key_index_find returns the first. A unique index keeps
+   one holder per key: ecs_entity_component_modified returns 0 and puts the
+   old key back when the new one is taken, and an attached or instantiated
+   row whose key is taken stays out of the index until it writes a free one. */
+size_t  ecs_key_index_create(size_t component_id, size_t offset, size_t key_size, int unique);
+void    ecs_key_index_destroy(size_t index_id);
+size_t  ecs_key_index_find(size_t index_id, const void *key);
+size_t *ecs_key_index_find_all(size_t index_id, const void *key, size_t *count);
+
+#define ECS_EVENT_ADD    1
+#define ECS_EVENT_REMOVE 2
+#define ECS_EVENT_SET    3 /* Reported with ecs_entity_component_modified */
+
+size_t  ecs_prefab_create(void);
+void    ecs_prefab_destroy(size_t prefab_id);
+void   *ecs_prefab_component_attach(size_t prefab_id, size_t component_id);
+void   *ecs_prefab_component_get(size_t prefab_id, size_t component_id);
+size_t  ecs_entity_instantiate(size_t prefab_id, size_t count);
+
+typedef void (*ecs_observer_function)(size_t component_id, int event, size_t *entities, size_t count, void *user_data);
+
+size_t  ecs_observer_register(size_t component_id, int event, ecs_observer_function callback, void *user_data);
+void    ecs_observer_unregister(size_t observer_id);
+void    ecs_observers_flush(void);
+
+/* Pipeline: ecs_progress runs the systems of each phase in registration
+   order and ends with ecs_update. Between phases the world is synced:
+   reserved entities are added, destroyed entities reclaimed and observers
+   flushed. Fixed-phase systems run in whole steps of the fixed step (1/60 s
+   by default) and get it as dt; the step is their rate, so registering one
+   with a frequency other than 0 fails. Other systems registered with a
+   frequency run at most once a frame at that rate and get the time since
+   their last run; their first runs are spread so they do not land on the
+   same frame. */
+#define ECS_PHASE_PRE_UPDATE  1
+#define ECS_PHASE_FIXED       2
+#define ECS_PHASE_UPDATE      3
+#define ECS_PHASE_POST_UPDATE 4
+
+typedef void (*ecs_system_function)(float dt, void *user_data);
+
+size_t  ecs_system_register(int phase, ecs_system_function function, float frequency, void *user_data);
+void    ecs_system_unregister(size_t system_id);
+
+/* Access declarations: a system that declares the components and resources
+   it reads and writes may share a batch with the declared systems around it
+   in the same phase, as long as neither writes what the other reads or
+   writes. A batch runs through ecs_parallel_for, so with a thread pool its
+   systems run at the same time and must only touch their declared data
+   through get, ecs_component_data and ecs_resource_get: no queries and no
+   structural changes. Systems that declare nothing run alone, in order. */
+#define ECS_READ  1
+#define ECS_WRITE 2
+
+int     ecs_system_component_access(size_t system_id, size_t component_id, int access);
+int     ecs_system_resource_access(size_t system_id, size_t resource_id, int access);
+int     ecs_system_conflicts(size_t system_id, size_t other_id);
+void    ecs_fixed_step_set(float step);
+void    ecs_progress(float dt);
+
+typedef int (*ecs_compare_function)(const void *a, const void *b);
+typedef void (*ecs_job_function)(size_t index, void *data);
+
+void    ecs_component_sort(size_t component_id, ecs_compare_function compare);
+
+size_t  ecs_component_count(size_t component_id);
+size_t  ecs_component_memory(size_t component_id);
+void   *ecs_component_data(size_t component_id);
+
+/* Double-buffered components: ecs_entity_component_get and ecs_component_data
+   give the column being written, the _prev accessors the values as of the
+   last ecs_update, which swaps the two by pointer. Readers of _prev and
+   writers of the other column can run in parallel without locks. After the
+   swap the write column holds the values from two updates ago, so writers
+   must fill every row they own each update. _refresh opts a component into
+   partial writes: ecs_update then copies the read column into the write
+   column, one count*size block copy per update. */
+int     ecs_component_double_buffer(size_t component_id);
+int     ecs_component_double_buffer_refresh(size_t component_id);
+void   *ecs_entity_component_get_prev(size_t entity_id, size_t component_id);
+void   *ecs_component_data_prev(size_t component_id);
+size_t *ecs_component_entities(size_t component_id);
+
+/* Journal of entity creation and destruction, attach, detach and writes
+   reported with ecs_entity_component_modified, flushed by ecs_update.
+   Recover by replaying a snapshot and then the journal started right after
+   it into a world with the same components registered. */
+int     ecs_journal_open(const char *path);
+int     ecs_journal_flush(void);
+int     ecs_journal_close(void);
+int     ecs_journal_snapshot(const char *path);
+int     ecs_journal_replay(const char *path);
+
+/* Query results live in a per-world arena and stay valid until ecs_update */
 typedef struct
 ecs_query_result
 {
-    size_t count;
-    void ***list;
+    size_t count;            /* Matching entities */
+    size_t components_count; /* Columns per row */
+    size_t *entities;        /* Id of each matching entity */
+    void **list;             /* count*components_count pointers, one row per entity */
 } ecs_query_result;
 
+#define ecs_query_get(result, row, column) ((result)->list[(row)*(result)->components_count + (column)])
+
+/* Columns come in the order the ids are passed, a repeated id repeats its
+   column. Queries match on the distinct ids sorted. */
 ecs_query_result *ecs_query(size_t num_components, ...);
 
+size_t  ecs_query_create(size_t num_components, ...);
+void    ecs_query_destroy(size_t query_id);
+ecs_query_result *ecs_query_run(size_t query_id);
+
+/* At most budget matches per call, resuming where the previous call of the
+   same query stopped and wrapping around, so heavy systems can spread a pass
+   over several frames. Entities created or destroyed in between are picked
+   up or skipped. */
+ecs_query_result *ecs_query_run_budget(size_t query_id, size_t budget);
+
+#define ECS_HIERARCHY_ROOT ((size_t)-1)
+
+typedef struct
+ecs_hierarchy_result
+{
+    size_t count;
+    size_t *entities; /* Breadth-first, every parent comes before its children */
+    size_t *parents;  /* Index of the parent in entities, ECS_HIERARCHY_ROOT for roots */
+} ecs_hierarchy_result;
+
+/* Ignored when either entity is unknown or destroyed, or it would make a cycle */
+void    ecs_entity_parent_set(size_t entity_id, size_t parent_id);
+size_t  ecs_entity_parent_get(size_t entity_id);
+size_t *ecs_entity_children(size_t entity_id, size_t *count);
+void    ecs_entity_destroy_tree(size_t entity_id);
+ecs_hierarchy_result *ecs_hierarchy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
 
 #ifdef ECS_IMPLEMENTATION
@@ -34,6 +259,8 @@ ecs_query_result *ecs_query(size_t num_components, ...);
 #define ECS_IMPLEMENTED
 
 #include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
 
 /* Utils */
 
@@ -44,6 +271,45 @@ ecs_query_result *ecs_query(size_t num_components, ...);
 #define ecs_free free
 #endif
 
+/* Runs job(i, data) for every i below count and returns once all are done.
+   Define it before including the implementation to run jobs on a thread pool. */
+#ifndef ecs_parallel_for
+#define ecs_parallel_for(count, job, data) ecs_parallel_for_serial((count), (job), (data))
+#endif
+
+void
+ecs_parallel_for_serial(size_t count, ecs_job_function job, void *data)
+{
+    size_t i;
+
+    for(i = 0;
+        i < count;
+        ++i)
+    {
+        job(i, data);
+    }
+}
+
+#ifndef ecs_memcpy
+#include <string.h>
+#define ecs_memcpy memcpy
+#define ecs_memset memset
+#endif
+
+/* Adds value to the size_t at ptr as one atomic step and returns the previous
+   value. Define it before including the implementation for other compilers. */
+#ifndef ecs_atomic_add
+#if defined(_MSC_VER) && defined(_WIN64)
+#include <intrin.h>
+#define ecs_atomic_add(ptr, value) ((size_t)_InterlockedExchangeAdd64((volatile __int64 *)(ptr), (__int64)(value)))
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define ecs_atomic_add(ptr, value) ((size_t)_InterlockedExchangeAdd((volatile long *)(ptr), (long)(value)))
+#else
+#define ecs_atomic_add(ptr, value) __sync_fetch_and_add((ptr), (value))
+#endif
+#endif
+
 #define da_malloc ecs_malloc
 #define da_realloc ecs_realloc
 #define da_free ecs_free
@@ -52,1071 +318,7924 @@ ecs_query_result *ecs_query(size_t num_components, ...);
 void
 ecs_mem_copy(void *src, void *dst, size_t num_bytes)
 {
-    size_t i;
-    unsigned char *s, *d;
-
-    s = (unsigned char *)src;
-    d = (unsigned char *)dst;
-    for(i = 0;
-        i < num_bytes;
-        ++i)
+    if(num_bytes)
     {
-        *d++ = *s++;
+        ecs_memcpy(dst, src, num_bytes);
     }
 }
 
 void
 ecs_mem_zero(void *dst, size_t num_bytes)
 {
-    size_t i;
-    unsigned char *d;
-
-    d = (unsigned char *)dst;
-    for(i = 0;
-        i < num_bytes;
-        ++i)
+    if(num_bytes)
     {
-        *d++ = 0;
+        ecs_memset(dst, 0, num_bytes);
     }
 }
 
-/* Map */
-
-typedef struct
-ecs_map_entry
+void*
+ecs_mem_clone(void *src, size_t cap_bytes, size_t num_bytes)
 {
-    size_t key;
-    size_t value;
-    int free;
-} ecs_map_entry;
+    void *dst;
 
-typedef struct
-ecs_map
-{
-    ecs_map_entry *entries;
-} ecs_map;
+    if(!src || !cap_bytes)
+    {
+        return(0);
+    }
+
+    dst = ecs_malloc(cap_bytes);
+    if(dst)
+    {
+        ecs_mem_copy(src, dst, num_bytes);
+    }
+
+    return(dst);
+}
 
 size_t*
-ecs_map_get(ecs_map *map, size_t key)
+ecs_ids_clone(size_t *src)
 {
+    size_t *dst;
     size_t i;
 
+    dst = 0;
     for(i = 0;
-        i < da_len(map->entries);
+        i < da_len(src);
         ++i)
     {
-        if(map->entries[i].free)
-        {
-            continue;
-        }
-
-        if(map->entries[i].key == key)
-        {
-            return(&(map->entries[i].value));
-        }
+        da_push(dst, src[i]);
     }
 
-    return(0);
+    return(dst);
 }
 
-void
-ecs_map_add(ecs_map *map, size_t key, size_t value)
+int
+ecs_mem_reserve(void **data, size_t *cap, size_t count, size_t unit_size)
 {
-    ecs_map_entry *free_entry;
-    size_t i;
+    size_t new_cap;
+    void *new_data;
 
-    free_entry = 0;
-    for(i = 0;
-        i < da_len(map->entries);
-        ++i)
+    if(count <= *cap)
     {
-        if(map->entries[i].free)
-        {
-            free_entry = &(map->entries[i]);
-            break;
-        }
+        return(1);
     }
 
-    if(free_entry)
+    new_cap = *cap*2 + 1;
+    if(new_cap < count)
     {
-        free_entry->free = 0;
-        free_entry->key = key;
-        free_entry->value = value;
+        new_cap = count;
     }
-    else
+
+    new_data = ecs_realloc(*data, new_cap*unit_size);
+    if(!new_data)
     {
-        ecs_map_entry entry = {0};
-        entry.key = key;
-        entry.value = value;
-        entry.free = 0;
-        da_push(map->entries, entry);
+        return(0);
     }
-}
 
-void
-ecs_map_set(ecs_map *map, size_t key, size_t value)
-{
-    size_t *value_ptr;
+    *data = new_data;
+    *cap = new_cap;
 
-    value_ptr = ecs_map_get(map, key);
-    if(value_ptr)
-    {
-        *value_ptr = value;
-    }
-    else
-    {
-        ecs_map_add(map, key, value);
-    }
+    return(1);
 }
 
-void
-ecs_map_unset(ecs_map *map, size_t key)
+/* Stable bottom-up merge sort of the positions of count elements of
+   unit_size bytes at base. indices holds 2*count entries, the returned half
+   lists the positions in ascending order. */
+size_t*
+ecs_sort_order(
+    void *base,
+    size_t count,
+    size_t unit_size,
+    ecs_compare_function compare,
+    size_t *indices)
 {
-    size_t i;
+    unsigned char *data;
+    size_t *order, *scratch, *swap;
+    size_t width, i;
 
+    data = (unsigned char *)base;
+    order = indices;
+    scratch = indices + count;
     for(i = 0;
-        i < da_len(map->entries);
+        i < count;
         ++i)
     {
-        if(map->entries[i].free)
-        {
-            continue;
-        }
+        order[i] = i;
+    }
 
-        if(map->entries[i].key == key)
+    for(width = 1;
+        width < count;
+        width *= 2)
+    {
+        for(i = 0;
+            i < count;
+            i += 2*width)
         {
-            map->entries[i].free = 1;
-            break;
+            size_t left, left_end, right, right_end, k;
+
+            left = i;
+            left_end = (i + width < count) ? i + width : count;
+            right = left_end;
+            right_end = (i + 2*width < count) ? i + 2*width : count;
+
+            k = i;
+            while(left < left_end && right < right_end)
+            {
+                if(compare(data + order[right]*unit_size, data + order[left]*unit_size) < 0)
+                {
+                    scratch[k++] = order[right++];
+                }
+                else
+                {
+                    scratch[k++] = order[left++];
+                }
+            }
+
+            while(left < left_end)
+            {
+                scratch[k++] = order[left++];
+            }
+
+            while(right < right_end)
+            {
+                scratch[k++] = order[right++];
+            }
         }
+
+        swap = order;
+        order = scratch;
+        scratch = swap;
     }
+
+    return(order);
 }
 
-void
-ecs_map_free(ecs_map *map)
+int
+ecs_ids_compare(const void *a, const void *b)
 {
-    da_free(map->entries);
-}
+    size_t x, y;
 
-/* Entity manager */
+    x = *(const size_t *)a;
+    y = *(const size_t *)b;
+
+    return((x > y) - (x < y));
+}
 
-#define ECS_COMPONENT_MASK_BITS (sizeof(size_t)*8)
+/* Arena */
 
 typedef struct
-ecs_entity
+ecs_arena_block
 {
-    size_t id;
-    size_t *component_mask;
-    int dead;
-    int destroyed;
-} ecs_entity;
+    struct ecs_arena_block *next;
+    size_t size;
+    size_t used;
+} ecs_arena_block;
 
 typedef struct
-ecs_entity_manager
+ecs_arena
 {
-    size_t current_id;
-
-    size_t cap;
-    ecs_entity *entities;
-
-    ecs_map id_to_index;
-    ecs_map index_to_id;
+    ecs_arena_block *blocks;
+    size_t total;
+} ecs_arena;
 
-    size_t *free_slots;
-} ecs_entity_manager;
+#define ECS_ARENA_ALIGNMENT (2*sizeof(void *))
+#define ECS_ARENA_HEADER ((sizeof(ecs_arena_block) + ECS_ARENA_ALIGNMENT - 1) & ~(ECS_ARENA_ALIGNMENT - 1))
 
-size_t
-ecs_entity_manager_create(ecs_entity_manager *entity_manager)
+void*
+ecs_arena_push(ecs_arena *arena, size_t num_bytes)
 {
-    size_t entity_id, entity_index;
-    ecs_entity entity = {0};
-    size_t free_slots_length;
+    ecs_arena_block *block;
+    void *result;
 
-    entity_id = ++entity_manager->current_id;
-    entity.id = entity_id;
+    num_bytes = (num_bytes + ECS_ARENA_ALIGNMENT - 1) & ~(ECS_ARENA_ALIGNMENT - 1);
 
-    /* TODO: Check index in free_slots first */
-    free_slots_length = da_len(entity_manager->free_slots);
-    if(free_slots_length > 0)
+    block = arena->blocks;
+    if(!block || block->size - block->used < num_bytes)
     {
-        entity_index = entity_manager->free_slots[free_slots_length - 1];
-        da_pop(entity_manager->free_slots);
-        entity_manager->entities[entity_index] = entity;
-    }
-    else
-    {
-        entity_index = da_len(entity_manager->entities);
-        da_push(entity_manager->entities, entity);
-        entity_manager->cap += 1;
+        size_t size;
+
+        size = block ? block->size*2 : 4096;
+        if(size < num_bytes)
+        {
+            size = num_bytes;
+        }
+
+        block = (ecs_arena_block *)ecs_malloc(ECS_ARENA_HEADER + size);
+        if(!block)
+        {
+            return(0);
+        }
+
+        block->next = arena->blocks;
+        block->size = size;
+        block->used = 0;
+        arena->blocks = block;
+        arena->total += size;
     }
 
-    ecs_map_set(&entity_manager->id_to_index, entity_id, entity_index);
-    ecs_map_set(&entity_manager->index_to_id, entity_index, entity_id);
+    result = (unsigned char *)block + ECS_ARENA_HEADER + block->used;
+    block->used += num_bytes;
 
-    return(entity_id);
+    return(result);
 }
 
 void
-ecs_entity_manager_destroy(
-    ecs_entity_manager *entity_manager,
-    size_t entity_id)
+ecs_arena_free(ecs_arena *arena)
 {
-    size_t *entity_index_ptr, entity_index;
-    ecs_entity *entity;
+    ecs_arena_block *block, *next;
 
-    entity_index_ptr = ecs_map_get(&entity_manager->id_to_index, entity_id);
-    if(!entity_index_ptr)
+    for(block = arena->blocks;
+        block;
+        block = next)
     {
-        return;
+        next = block->next;
+        ecs_free(block);
     }
 
-    entity_index = *entity_index_ptr;
-    entity = &(entity_manager->entities[entity_index]);
-
-    da_push(entity_manager->free_slots, entity_index);
-    ecs_map_unset(&entity_manager->id_to_index, entity_id);
-    ecs_map_unset(&entity_manager->index_to_id, entity_index);
-    entity->destroyed = 1;
+    arena->blocks = 0;
+    arena->total = 0;
 }
 
-ecs_entity*
-ecs_entity_manager_get_at(
-    ecs_entity_manager *entity_manager,
-    size_t index)
+/* Everything pushed so far is released. A frame that needed several blocks
+   gets a single block of their total size, so the next one allocates nothing. */
+void
+ecs_arena_reset(ecs_arena *arena)
 {
-    if(index >= da_len(entity_manager->entities))
+    size_t total;
+
+    if(arena->blocks && arena->blocks->next)
     {
-        return(0);
+        total = arena->total;
+        ecs_arena_free(arena);
+        if(ecs_arena_push(arena, total))
+        {
+            arena->blocks->used = 0;
+        }
+    }
+    else if(arena->blocks)
+    {
+        arena->blocks->used = 0;
     }
-
-    return(&(entity_manager->entities[index]));
 }
 
-ecs_entity*
-ecs_entity_manager_get(
-    ecs_entity_manager *entity_manager,
-    size_t entity_id)
-{
-    size_t *entity_index_ptr, entity_index;
+/* Slab allocator */
 
-    entity_index_ptr = ecs_map_get(&entity_manager->id_to_index, entity_id);
-    if(!entity_index_ptr)
-    {
-        return(0);
-    }
+/* Power of two size classes from ECS_SLAB_MIN bytes up, carved out of
+   ECS_SLAB_SIZE chunks and recycled through one free list per class.
+   Anything larger goes to ecs_malloc on its own. */
 
-    entity_index = *entity_index_ptr;
-    return(ecs_entity_manager_get_at(entity_manager, entity_index));
-}
+#ifndef ECS_SLAB_SIZE
+#define ECS_SLAB_SIZE (64*1024) /* At least the largest class */
+#endif
 
-/* Component list */
+#define ECS_SLAB_MIN 16
+#define ECS_SLAB_CLASSES 12 /* Largest class is ECS_SLAB_MIN << 11, 32 KiB */
+#define ECS_SLAB_HEADER ((sizeof(ecs_slab_chunk) + ECS_ARENA_ALIGNMENT - 1) & ~(ECS_ARENA_ALIGNMENT - 1))
 
 typedef struct
-ecs_component_list
+ecs_slab_chunk
 {
-    size_t id;
+    struct ecs_slab_chunk *next;
+} ecs_slab_chunk;
 
-    ecs_map entity_to_index;
-    ecs_map index_to_entity;
+typedef struct
+ecs_slab
+{
+    void *free_lists[ECS_SLAB_CLASSES];
+    unsigned char *cursor[ECS_SLAB_CLASSES];
+    size_t left[ECS_SLAB_CLASSES];
 
-    int destroyed;
+    ecs_slab_chunk *chunks;
+    size_t chunks_bytes;
+    size_t large_bytes;
 
-    size_t unit_size;
-    size_t count;
-    size_t cap;
-    void *data;
-} ecs_component_list;
+    /* Blocks released since the last ecs_update, returned in bulk */
+    ecs_blob *pending;
+    size_t pending_count;
+    size_t pending_cap;
+} ecs_slab;
 
-void*
-ecs_component_list_get_at(
-    ecs_component_list *component_list,
-    size_t index)
+/* ECS_SLAB_CLASSES for blocks that bypass the slabs */
+size_t
+ecs_slab_class(size_t size)
 {
-    if(index >= component_list->count)
+    size_t slab_class;
+
+    slab_class = 0;
+    while(slab_class < ECS_SLAB_CLASSES && ((size_t)ECS_SLAB_MIN << slab_class) < size)
     {
-        return(0);
+        ++slab_class;
     }
 
-    return((void *)((unsigned char *)component_list->data + index*component_list->unit_size));
+    return(slab_class);
 }
 
 void*
-ecs_component_list_get(
-    ecs_component_list *component_list,
-    size_t entity_id)
+ecs_slab_alloc(ecs_slab *slab, size_t size)
 {
-    size_t *index;
+    size_t slab_class, block_size;
+    void *block;
 
-    index = ecs_map_get(&component_list->entity_to_index, entity_id);
-    if(!index)
+    if(size == 0)
     {
         return(0);
     }
 
-    return(ecs_component_list_get_at(component_list, *index));
-}
+    slab_class = ecs_slab_class(size);
+    if(slab_class == ECS_SLAB_CLASSES)
+    {
+        block = ecs_malloc(size);
+        if(block)
+        {
+            slab->large_bytes += size;
+        }
 
-void
-ecs_component_list_add(
-    ecs_component_list *component_list,
-    size_t entity_id,
-    void *component)
-{
-    size_t index;
-    void *src, *dst;
-
-    if(ecs_map_get(&component_list->entity_to_index, entity_id))
-    {
-        /* Component already assigned to this entity */
-        return;
+        return(block);
     }
 
-    index = component_list->count;
-
-    if(component_list->cap == 0)
+    if(slab->free_lists[slab_class])
     {
-        component_list->cap = 1;
-        component_list->data = ecs_malloc(component_list->cap*component_list->unit_size);
-        if(!component_list->data)
-        {
-            component_list->cap = 0;
-            return;
-        }
+        block = slab->free_lists[slab_class];
+        slab->free_lists[slab_class] = *(void **)block;
+        return(block);
     }
-    else
+
+    block_size = (size_t)ECS_SLAB_MIN << slab_class;
+    if(slab->left[slab_class] < block_size)
     {
-        if(component_list->cap <= component_list->count)
+        ecs_slab_chunk *chunk;
+
+        chunk = (ecs_slab_chunk *)ecs_malloc(ECS_SLAB_HEADER + ECS_SLAB_SIZE);
+        if(!chunk)
         {
-            component_list->cap = component_list->cap*2 + 1;
-            component_list->data = ecs_realloc(component_list->data, component_list->cap*component_list->unit_size);
-            if(!component_list->data)
-            {
-                component_list->cap = 0;
-                return;
-            }
+            return(0);
         }
+
+        chunk->next = slab->chunks;
+        slab->chunks = chunk;
+        slab->chunks_bytes += ECS_SLAB_SIZE;
+        slab->cursor[slab_class] = (unsigned char *)chunk + ECS_SLAB_HEADER;
+        slab->left[slab_class] = ECS_SLAB_SIZE;
     }
 
-    ecs_map_set(&component_list->entity_to_index, entity_id, index);
-    ecs_map_set(&component_list->index_to_entity, index, entity_id);
+    block = slab->cursor[slab_class];
+    slab->cursor[slab_class] += block_size;
+    slab->left[slab_class] -= block_size;
 
-    component_list->count += 1;
+    return(block);
+}
 
-    dst = ecs_component_list_get_at(component_list, index);
-    if(component)
+/* size is the one the block was allocated with, or any size of the same class */
+void
+ecs_slab_free(ecs_slab *slab, void *block, size_t size)
+{
+    size_t slab_class;
+
+    if(!block)
     {
-        src = (void *)((unsigned char *)component);
-        ecs_mem_copy(src, dst, component_list->unit_size);
+        return;
     }
-    else
+
+    slab_class = ecs_slab_class(size);
+    if(slab_class == ECS_SLAB_CLASSES)
     {
-        ecs_mem_zero(dst, component_list->unit_size);
+        slab->large_bytes -= size;
+        ecs_free(block);
+        return;
     }
+
+    *(void **)block = slab->free_lists[slab_class];
+    slab->free_lists[slab_class] = block;
 }
 
+/* Keeps the block readable until ecs_slab_flush */
 void
-ecs_component_list_remove(
-    ecs_component_list *component_list,
-    size_t entity_id)
+ecs_slab_release(ecs_slab *slab, ecs_blob blob)
 {
-    size_t *index_ptr, index, last_index, *last_entity_ptr, last_entity;
-    void *src, *dst;
-
-    if(!component_list->count)
+    if(!blob.data)
     {
         return;
     }
 
-    index_ptr = ecs_map_get(&component_list->entity_to_index, entity_id);
-    if(!index_ptr)
+    if(!ecs_mem_reserve((void **)&slab->pending, &slab->pending_cap, slab->pending_count + 1, sizeof(ecs_blob)))
     {
-        /* Entity does not have this component */
+        ecs_slab_free(slab, blob.data, blob.size);
         return;
     }
 
-    index = *index_ptr;
-    last_index = component_list->count - 1;
+    slab->pending[slab->pending_count++] = blob;
+}
 
-    src = ecs_component_list_get_at(component_list, last_index);
-    dst = ecs_component_list_get_at(component_list, index);
-    ecs_mem_copy(src, dst, component_list->unit_size);
+void
+ecs_slab_flush(ecs_slab *slab)
+{
+    size_t i;
 
-    last_entity_ptr = ecs_map_get(&component_list->index_to_entity, last_index);
-    if(!last_entity_ptr)
+    for(i = 0;
+        i < slab->pending_count;
+        ++i)
     {
-        /* TODO: DEBUG: Is this behavior correct? */
-        return;
+        ecs_slab_free(slab, slab->pending[i].data, slab->pending[i].size);
     }
 
-    last_entity = *last_entity_ptr;
-    ecs_map_set(&component_list->entity_to_index, last_entity, index);
-    ecs_map_set(&component_list->index_to_entity, index, last_entity);
-
-    ecs_map_unset(&component_list->entity_to_index, entity_id);
-    ecs_map_unset(&component_list->index_to_entity, last_index);
+    slab->pending_count = 0;
 }
 
+/* Blocks above the largest class that are still in use must be freed first */
 void
-ecs_component_list_entity_destroyed(
-    ecs_component_list *component_list,
-    size_t entity_id)
+ecs_slab_destroy(ecs_slab *slab)
 {
-    ecs_component_list_remove(component_list, entity_id);
+    ecs_slab_chunk *chunk, *next;
+
+    ecs_slab_flush(slab);
+
+    for(chunk = slab->chunks;
+        chunk;
+        chunk = next)
+    {
+        next = chunk->next;
+        ecs_free(chunk);
+    }
+
+    ecs_free(slab->pending);
+    ecs_mem_zero(slab, sizeof(*slab));
 }
 
-/* Component manager */
+size_t
+ecs_slab_memory(ecs_slab *slab)
+{
+    return(slab->chunks_bytes + slab->large_bytes + slab->pending_cap*sizeof(ecs_blob));
+}
+
+/* Map */
+
+/* Open addressing with linear probing over a power of two table. Removed
+   entries stay as markers so probes walk past them until the next rebuild. */
+
+#define ECS_MAP_EMPTY 0
+#define ECS_MAP_USED 1
+#define ECS_MAP_REMOVED 2
+
+#define ECS_MAP_MIN_CAP 16
 
 typedef struct
-ecs_component_manager
+ecs_map_entry
 {
-    size_t current_id;
-    ecs_component_list *lists;
+    size_t key;
+    size_t value;
+    int state;
+} ecs_map_entry;
+
+typedef struct
+ecs_map
+{
+    ecs_map_entry *entries;
     size_t cap;
+    size_t count;
+    size_t removed;
+} ecs_map;
 
-    ecs_map id_to_index;
-    ecs_map index_to_id;
+size_t
+ecs_map_hash(size_t key)
+{
+    size_t hash;
 
-    size_t *free_slots;
-} ecs_component_manager;
+    hash = key;
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bu;
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bu;
+    hash ^= hash >> 16;
 
+    return(hash);
+}
+
+/* Smallest table that keeps count entries at most half full */
 size_t
-ecs_component_manager_register(
-    ecs_component_manager *component_manager,
-    size_t component_size)
+ecs_map_cap_for(size_t count)
 {
-    size_t component_id, component_index;
-    ecs_component_list list = {0};
-    size_t free_slots_length;
+    size_t cap;
 
-    if(component_size == 0)
+    cap = ECS_MAP_MIN_CAP;
+    while(cap < count*2)
     {
-        return(0);
+        cap *= 2;
     }
 
-    /* TODO: Check index in free_slots first */
-    component_id = ++component_manager->current_id;
-    list.id = component_id;
-    list.unit_size = component_size;
+    return(cap);
+}
 
-    free_slots_length = da_len(component_manager->free_slots);
-    if(free_slots_length > 0)
+/* Moves the used entries into a table of cap slots and drops the removal markers */
+int
+ecs_map_rehash(ecs_map *map, size_t cap)
+{
+    ecs_map_entry *entries;
+    size_t i, slot;
+
+    entries = (ecs_map_entry *)ecs_malloc(cap*sizeof(ecs_map_entry));
+    if(!entries)
     {
-        component_index = component_manager->free_slots[free_slots_length - 1];
-        da_pop(component_manager->free_slots);
-        component_manager->lists[component_index] = list;
+        return(0);
     }
-    else
+
+    ecs_mem_zero(entries, cap*sizeof(ecs_map_entry));
+    for(i = 0;
+        i < map->cap;
+        ++i)
     {
-        component_index = da_len(component_manager->lists);
-        da_push(component_manager->lists, list);
-        component_manager->cap += 1;
+        if(map->entries[i].state != ECS_MAP_USED)
+        {
+            continue;
+        }
+
+        slot = ecs_map_hash(map->entries[i].key) & (cap - 1);
+        while(entries[slot].state == ECS_MAP_USED)
+        {
+            slot = (slot + 1) & (cap - 1);
+        }
+
+        entries[slot] = map->entries[i];
     }
 
-    ecs_map_set(&component_manager->id_to_index, component_id, component_index);
-    ecs_map_set(&component_manager->index_to_id, component_index, component_id);
+    ecs_free(map->entries);
+    map->entries = entries;
+    map->cap = cap;
+    map->removed = 0;
 
-    return(component_id);
+    return(1);
 }
 
-void
-ecs_component_manager_unregister(
-    ecs_component_manager *component_manager,
-    size_t component_id)
+/* Makes room for extra more entries without a rebuild in between */
+int
+ecs_map_reserve(ecs_map *map, size_t extra)
 {
-    size_t *component_index_ptr, component_index;
-    ecs_component_list *list;
-
-    component_index_ptr = ecs_map_get(&component_manager->id_to_index, component_id);
-    if(!component_index_ptr)
+    if((map->count + map->removed + extra)*4 <= map->cap*3)
     {
-        return;
+        return(1);
     }
 
-    component_index = *component_index_ptr;
-    list = &(component_manager->lists[component_index]);
-
-    da_push(component_manager->free_slots, component_index);
-    ecs_map_free(&list->entity_to_index);
-    ecs_map_free(&list->index_to_entity);
-    ecs_free(list->data);
-
-    list->destroyed = 1;
+    return(ecs_map_rehash(map, ecs_map_cap_for(map->count + extra)));
 }
 
-void
-ecs_component_manager_add(
-    ecs_component_manager *component_manager,
-    size_t entity_id,
-    size_t component_id)
+size_t*
+ecs_map_get(ecs_map *map, size_t key)
 {
-    size_t *list_index_ptr, list_index;
-    ecs_component_list *list;
+    size_t slot;
 
-    list_index_ptr = ecs_map_get(&component_manager->id_to_index, component_id);
-    if(!list_index_ptr)
+    if(!map->cap)
     {
-        return;
+        return(0);
     }
 
-    list_index = *list_index_ptr;
-    list = &(component_manager->lists[list_index]);
+    slot = ecs_map_hash(key) & (map->cap - 1);
+    while(map->entries[slot].state != ECS_MAP_EMPTY)
+    {
+        if(map->entries[slot].state == ECS_MAP_USED && map->entries[slot].key == key)
+        {
+            return(&(map->entries[slot].value));
+        }
 
-    ecs_component_list_add(list, entity_id, 0);
+        slot = (slot + 1) & (map->cap - 1);
+    }
+
+    return(0);
 }
 
-void
-ecs_component_manager_remove(
-    ecs_component_manager *component_manager,
-    size_t entity_id,
-    size_t component_id)
+/* Inserts without looking for the key, callers make sure it is not there yet */
+int
+ecs_map_add(ecs_map *map, size_t key, size_t value)
 {
-    size_t *list_index_ptr, list_index;
-    ecs_component_list *list;
+    size_t slot;
 
-    list_index_ptr = ecs_map_get(&component_manager->id_to_index, component_id);
-    if(!list_index_ptr)
+    /* Without room to grow keep one empty slot so lookups still end */
+    if(!ecs_map_reserve(map, 1) && map->count + map->removed + 1 >= map->cap)
     {
-        return;
+        return(0);
     }
 
-    list_index = *list_index_ptr;
-    list = &(component_manager->lists[list_index]);
+    slot = ecs_map_hash(key) & (map->cap - 1);
+    while(map->entries[slot].state == ECS_MAP_USED)
+    {
+        slot = (slot + 1) & (map->cap - 1);
+    }
 
-    ecs_component_list_remove(list, entity_id);
+    if(map->entries[slot].state == ECS_MAP_REMOVED)
+    {
+        --map->removed;
+    }
+
+    map->entries[slot].key = key;
+    map->entries[slot].value = value;
+    map->entries[slot].state = ECS_MAP_USED;
+    ++map->count;
+
+    return(1);
 }
 
-void*
-ecs_component_manager_get(
-    ecs_component_manager *component_manager,
-    size_t entity_id,
-    size_t component_id)
+int
+ecs_map_set(ecs_map *map, size_t key, size_t value)
 {
-    size_t *list_index_ptr, list_index;
-    ecs_component_list *list;
+    size_t *value_ptr;
 
-    list_index_ptr = ecs_map_get(&component_manager->id_to_index, component_id);
-    if(!list_index_ptr)
+    value_ptr = ecs_map_get(map, key);
+    if(value_ptr)
     {
-        return(0);
+        *value_ptr = value;
+        return(1);
     }
 
-    list_index = *list_index_ptr;
-    list = &(component_manager->lists[list_index]);
-
-    return(ecs_component_list_get(list, entity_id));
+    return(ecs_map_add(map, key, value));
 }
 
 void
-ecs_component_manager_entity_destroyed(
-    ecs_component_manager *component_manager,
-    size_t entity_id)
+ecs_map_unset(ecs_map *map, size_t key)
 {
-    size_t lists_count;
-    size_t i;
+    size_t *value_ptr;
+    ecs_map_entry *entry;
 
-    lists_count = da_len(component_manager->lists);
-    for(i = 0;
-        i < lists_count;
-        ++i)
+    value_ptr = ecs_map_get(map, key);
+    if(value_ptr)
     {
-        ecs_component_list_entity_destroyed(&(component_manager->lists[i]), entity_id);
+        entry = (ecs_map_entry *)((unsigned char *)value_ptr - offsetof(ecs_map_entry, value));
+        entry->state = ECS_MAP_REMOVED;
+        --map->count;
+        ++map->removed;
     }
 }
 
-/* World */
-
-typedef struct
-ecs_world
+void
+ecs_map_free(ecs_map *map)
 {
-    size_t id;
+    ecs_free(map->entries);
+    ecs_mem_zero(map, sizeof(*map));
+}
 
-    ecs_entity_manager entity_manager;
-    ecs_component_manager component_manager;
-    ecs_query_result query_result;
+/* Drops removal markers and shrinks the table to fit the live entries */
+void
+ecs_map_compact(ecs_map *map)
+{
+    if(!map->count)
+    {
+        ecs_map_free(map);
+        return;
+    }
 
-    int dead;
-    int destroyed;
-} ecs_world;
-
-size_t
-ecs_world_entity_create(ecs_world *world)
-{
-    size_t entity_id;
-
-    entity_id = ecs_entity_manager_create(&world->entity_manager);
-
-    return(entity_id);
-}
-
-void
-ecs_world_entity_destroy(ecs_world *world, size_t entity_id)
-{
-    ecs_entity_manager_destroy(&world->entity_manager, entity_id);
-    ecs_component_manager_entity_destroyed(&world->component_manager, entity_id);
+    if(map->removed || ecs_map_cap_for(map->count) < map->cap)
+    {
+        ecs_map_rehash(map, ecs_map_cap_for(map->count));
+    }
 }
 
 size_t
-ecs_world_component_register(ecs_world *world, size_t component_size)
-{
-    size_t component_id;
-
-    component_id = ecs_component_manager_register(&world->component_manager, component_size);
-
-    return(component_id);
-}
-
-void
-ecs_world_component_unregister(ecs_world *world, size_t component_id)
+ecs_map_memory(ecs_map *map)
 {
-    ecs_component_manager_unregister(&world->component_manager, component_id);
+    return(map->cap*sizeof(ecs_map_entry));
 }
 
-void
-ecs_world_entity_component_attach(
-    ecs_world *world,
-    size_t entity_id,
-    size_t component_id)
+int
+ecs_map_clone(ecs_map *dst, ecs_map *src)
 {
-    ecs_entity *entity;
-    size_t mask_size;
-    size_t mask_index;
-    size_t mask_shift;
-
-    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
-    if(!entity)
+    ecs_mem_zero(dst, sizeof(*dst));
+    if(!src->cap)
     {
-        return;
+        return(1);
     }
 
-    ecs_component_manager_add(&world->component_manager, entity_id, component_id);
-
-    mask_size = da_len(entity->component_mask);
-    mask_index = (component_id - 1) / ECS_COMPONENT_MASK_BITS;
-    mask_shift = (component_id - 1) % ECS_COMPONENT_MASK_BITS;
-
-    while(mask_size <= mask_index)
+    dst->entries = (ecs_map_entry *)ecs_mem_clone(src->entries, src->cap*sizeof(ecs_map_entry),
+                                                  src->cap*sizeof(ecs_map_entry));
+    if(!dst->entries)
     {
-        da_push(entity->component_mask, 0);
-        mask_size += 1;
+        return(0);
     }
 
-    entity->component_mask[mask_index] |= ((size_t)1 << mask_shift);
+    dst->cap = src->cap;
+    dst->count = src->count;
+    dst->removed = src->removed;
+
+    return(1);
 }
 
-void
-ecs_world_entity_component_detach(
-    ecs_world *world,
-    size_t entity_id,
-    size_t component_id)
+/* Mask */
+
+/* Bitsets stored as size_t words, bit i stands for component id i + 1 in
+   component masks and for slot or row i in the disabled bitmaps. Entity and
+   prefab masks are darrays and query masks are plain arrays, so the helpers
+   take the words and their count. Words past the count read as 0. */
+
+#define ECS_MASK_BITS (sizeof(size_t)*8)
+#define ECS_MASK_END ((size_t)-1)
+#define ECS_MASK_WORD(bit) ((bit) / ECS_MASK_BITS)
+#define ECS_MASK_FLAG(bit) ((size_t)1 << ((bit) % ECS_MASK_BITS))
+
+size_t
+ecs_popcount_portable(size_t word)
 {
-    ecs_entity *entity;
-    size_t mask_size;
-    size_t mask_index;
-    size_t mask_shift;
+    size_t count;
 
-    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
-    if(!entity)
+    count = 0;
+    while(word)
     {
-        return;
+        word &= word - 1;
+        ++count;
     }
 
-    ecs_component_manager_remove(&world->component_manager, entity_id, component_id);
+    return(count);
+}
 
-    mask_size = da_len(entity->component_mask);
-    mask_index = (component_id - 1) / ECS_COMPONENT_MASK_BITS;
-    mask_shift = (component_id - 1) % ECS_COMPONENT_MASK_BITS;
+/* word must not be 0 */
+size_t
+ecs_ctz_portable(size_t word)
+{
+    size_t count;
 
-    while(mask_size <= mask_index)
+    count = 0;
+    while(!(word & 1))
     {
-        da_push(entity->component_mask, 0);
-        mask_size += 1;
+        word >>= 1;
+        ++count;
     }
 
-    entity->component_mask[mask_index] &= ~(1 << mask_shift);
+    return(count);
 }
 
+/* long long is C99, under C89 the long builtins are used when size_t fits
+   in a long and the portable loops otherwise (the sizeof test folds away) */
+#ifndef ecs_popcount
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
+#define ecs_popcount(word) ((size_t)__builtin_popcountll((unsigned long long)(word)))
+#define ecs_ctz(word) ((size_t)__builtin_ctzll((unsigned long long)(word)))
+#elif defined(__GNUC__) || defined(__clang__)
+#define ecs_popcount(word) (sizeof(size_t) <= sizeof(unsigned long) ? \
+    (size_t)__builtin_popcountl((unsigned long)(word)) : ecs_popcount_portable(word))
+#define ecs_ctz(word) (sizeof(size_t) <= sizeof(unsigned long) ? \
+    (size_t)__builtin_ctzl((unsigned long)(word)) : ecs_ctz_portable(word))
+#else
+#define ecs_popcount(word) ecs_popcount_portable(word)
+#define ecs_ctz(word) ecs_ctz_portable(word)
+#endif
+#endif
+
 int
-ecs_world_entity_component_has(
-    ecs_world *world,
-    size_t entity_id,
-    size_t component_id)
+ecs_mask_test(size_t *words, size_t count, size_t bit)
 {
-    ecs_entity *entity;
-    size_t mask_size;
-    size_t mask_index;
-    size_t mask_shift;
-
-    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
-    if(!entity || entity->dead)
+    if(ECS_MASK_WORD(bit) >= count)
     {
         return(0);
     }
 
-    mask_size = da_len(entity->component_mask);
-    mask_index = (component_id - 1) / ECS_COMPONENT_MASK_BITS;
-    mask_shift = (component_id - 1) % ECS_COMPONENT_MASK_BITS;
+    return((words[ECS_MASK_WORD(bit)] & ECS_MASK_FLAG(bit)) != 0);
+}
 
-    if(mask_size <= mask_index)
-    {
-        return(0);
-    }
+/* words must already hold the bit, see ecs_mask_grow */
+void
+ecs_mask_set(size_t *words, size_t bit)
+{
+    words[ECS_MASK_WORD(bit)] |= ECS_MASK_FLAG(bit);
+}
 
-    if((entity->component_mask[mask_index] & ((size_t)1 << mask_shift)) != 0)
+void
+ecs_mask_clear(size_t *words, size_t count, size_t bit)
+{
+    if(ECS_MASK_WORD(bit) < count)
     {
-        return(1);
+        words[ECS_MASK_WORD(bit)] &= ~ECS_MASK_FLAG(bit);
     }
-
-    return(0);
 }
 
-void*
-ecs_world_entity_component_get(
-    ecs_world *world,
-    size_t entity_id,
-    size_t component_id)
+/* Pads the darray mask with zero words until it holds bit */
+size_t*
+ecs_mask_grow(size_t *mask, size_t bit)
 {
-    if(!ecs_world_entity_component_has(world, entity_id, component_id))
+    while(da_len(mask) <= ECS_MASK_WORD(bit))
     {
-        return(0);
+        da_push(mask, 0);
     }
 
-    return(ecs_component_manager_get(&world->component_manager, entity_id, component_id));
+    return(mask);
 }
 
-#include <stdarg.h>
-
-ecs_query_result*
-ecs_world_query(ecs_world *world, size_t num_components, va_list args)
+/* 1 if every bit of required is set in words, one AND-NOT per word */
+int
+ecs_mask_contains(
+    size_t *words,
+    size_t count,
+    size_t *required,
+    size_t required_count)
 {
-    size_t entity_index;
-    size_t *components_ids;
-    size_t components_count;
-    size_t *entities_ids;
-    size_t entities_count;
     size_t i;
-    ecs_query_result *result;
-
-    result = &world->query_result;
 
-    components_ids = 0;
     for(i = 0;
-        i < num_components;
+        i < required_count;
         ++i)
     {
-        size_t component_id = va_arg(args, size_t);
-        if(component_id == 0)
+        size_t word;
+
+        word = i < count ? words[i] : 0;
+        if(required[i] & ~word)
         {
-            continue;
+            return(0);
         }
-
-        da_push(components_ids, component_id);
     }
 
-    components_count = da_len(components_ids);
+    return(1);
+}
 
-    entities_ids = 0;
-    entities_count = 0;
-    for(entity_index = 0;
-        entity_index < world->entity_manager.cap;
-        ++entity_index)
-    {
-        int has_required_components;
-        size_t *entity_id_ptr, entity_id;
+/* 1 if words and other share a set bit */
+int
+ecs_mask_intersects(
+    size_t *words,
+    size_t count,
+    size_t *other,
+    size_t other_count)
+{
+    size_t i;
 
-        entity_id_ptr = ecs_map_get(&world->entity_manager.index_to_id, entity_index);
-        if(!entity_id_ptr)
+    for(i = 0;
+        i < count && i < other_count;
+        ++i)
+    {
+        if(words[i] & other[i])
         {
-            continue;
+            return(1);
         }
+    }
 
-        entity_id = *entity_id_ptr;
+    return(0);
+}
 
-        has_required_components = 1;
-        for(i = 0;
-            i < components_count;
-            ++i)
-        {
-            if(!ecs_world_entity_component_has(world, entity_id, components_ids[i]))
-            {
-                has_required_components = 0;
-                break;
-            }
-        }
+/* 1 if bit starts a word with every bit set, so a whole word can be skipped */
+int
+ecs_mask_word_full(size_t *words, size_t count, size_t bit)
+{
+    return(bit % ECS_MASK_BITS == 0 && ECS_MASK_WORD(bit) < count && words[ECS_MASK_WORD(bit)] == ~(size_t)0);
+}
 
-        if(has_required_components)
-        {
-            da_push(entities_ids, entity_id);
-        }
+size_t
+ecs_mask_popcount(size_t *words, size_t count)
+{
+    size_t i, total;
+
+    total = 0;
+    for(i = 0;
+        i < count;
+        ++i)
+    {
+        total += ecs_popcount(words[i]);
     }
 
-    entities_count = da_len(entities_ids);
+    return(total);
+}
+
+/* First set bit at or after bit, ECS_MASK_END if there is none */
+size_t
+ecs_mask_next(size_t *words, size_t count, size_t bit)
+{
+    size_t index, word;
 
-    while(da_len(result->list) < entities_count)
+    index = ECS_MASK_WORD(bit);
+    if(index >= count)
     {
-        da_push(result->list, 0);
+        return(ECS_MASK_END);
     }
 
-    for(entity_index = 0;
-        entity_index < entities_count;
-        ++entity_index)
+    word = words[index] & (~(size_t)0 << (bit % ECS_MASK_BITS));
+    while(!word)
     {
-        while(da_len(result->list[entity_index]) < components_count)
+        if(++index >= count)
         {
-            da_push(result->list[entity_index], 0);
+            return(ECS_MASK_END);
         }
 
-        for(i = 0;
-            i < components_count;
-            ++i)
-        {
-            result->list[entity_index][i] = ecs_world_entity_component_get(world, entities_ids[entity_index], components_ids[i]);
-        }
+        word = words[index];
     }
 
-    result->count = entities_count;
-
-    return(result);
+    return(index*ECS_MASK_BITS + ecs_ctz(word));
 }
 
+/* Entity manager */
+
 typedef struct
-ecs_world_manager
+ecs_entity
 {
-    ecs_map id_to_index;
-    ecs_map index_to_id;
+    size_t id;
+    size_t *component_mask;
+    int dead;
+    int destroyed;
 
-    ecs_world *worlds;
-    size_t cap;
+    /* Disabled entities and components stay attached but queries skip them */
+    int disabled;
+    size_t *disabled_mask;
+
+    size_t parent;
+    size_t *children;
+} ecs_entity;
+
+typedef struct
+ecs_entity_manager
+{
     size_t current_id;
 
+    size_t cap;
+    ecs_entity *entities;
+
+    ecs_map id_to_index;
+    ecs_map index_to_id;
+
     size_t *free_slots;
-} ecs_world_manager;
 
-size_t
-ecs_world_manager_create(ecs_world_manager *world_manager)
+    /* Bit per slot, set for disabled entities so queries skip a word of them at once */
+    size_t *disabled;
+
+    /* Ids handed out by ecs_entity_reserve, added to the table on flush */
+    size_t *reserved;
+    size_t reserved_cap;
+    size_t reserved_count; /* Bumped atomically, may run past reserved_cap */
+} ecs_entity_manager;
+
+/* Callers hand in ids that are not in the table yet */
+ecs_entity*
+ecs_entity_manager_insert(ecs_entity_manager *entity_manager, size_t entity_id)
 {
-    size_t world_id, world_index;
-    ecs_world world = {0};
+    size_t entity_index;
+    ecs_entity entity = {0};
     size_t free_slots_length;
 
-    /* TODO: Check index in free_slots first */
-    world_id = ++world_manager->current_id;
-    world.id = world_id;
+    entity.id = entity_id;
 
-    free_slots_length = da_len(world_manager->free_slots);
+    /* TODO: Check index in free_slots first */
+    free_slots_length = da_len(entity_manager->free_slots);
     if(free_slots_length > 0)
     {
-        world_index = world_manager->free_slots[free_slots_length - 1];
-        da_pop(world_manager->free_slots);
-        world_manager->worlds[world_index] = world;
+        entity_index = entity_manager->free_slots[free_slots_length - 1];
+        da_pop(entity_manager->free_slots);
+        entity_manager->entities[entity_index] = entity;
+        ecs_mask_clear(entity_manager->disabled, da_len(entity_manager->disabled), entity_index);
     }
     else
     {
-        world_index = da_len(world_manager->worlds);
-        da_push(world_manager->worlds, world);
-        world_manager->cap += 1;
+        entity_index = da_len(entity_manager->entities);
+        da_push(entity_manager->entities, entity);
+        entity_manager->cap += 1;
     }
 
-    ecs_map_set(&world_manager->id_to_index, world_id, world_index);
-    ecs_map_set(&world_manager->index_to_id, world_index, world_id);
+    ecs_map_add(&entity_manager->id_to_index, entity_id, entity_index);
+    ecs_map_add(&entity_manager->index_to_id, entity_index, entity_id);
 
-    world_manager->cap += 1;
+    return(&(entity_manager->entities[entity_index]));
+}
 
-    return(world_id);
+size_t
+ecs_entity_manager_create(ecs_entity_manager *entity_manager)
+{
+    size_t entity_id;
+
+    /* Atomic so that ids never collide with concurrent reservations */
+    entity_id = ecs_atomic_add(&entity_manager->current_id, 1) + 1;
+    ecs_entity_manager_insert(entity_manager, entity_id);
+
+    return(entity_id);
 }
 
+/* Recreates an entity under a known id, used when replaying a journal */
 void
-ecs_world_manager_destroy(
-    ecs_world_manager *world_manager,
-    size_t world_id)
+ecs_entity_manager_create_with_id(ecs_entity_manager *entity_manager, size_t entity_id)
 {
-    size_t *world_index_ptr, world_index;
-    size_t entity_index, component_index;
-    ecs_world *world;
-
-    world_index_ptr = ecs_map_get(&world_manager->id_to_index, world_id);
-    if(!world_index_ptr)
+    if(entity_id == 0 || ecs_map_get(&entity_manager->id_to_index, entity_id))
     {
         return;
     }
 
-    world_index = *world_index_ptr;
-    world = &(world_manager->worlds[world_index]);
+    ecs_entity_manager_insert(entity_manager, entity_id);
+    if(entity_id > entity_manager->current_id)
+    {
+        entity_manager->current_id = entity_id;
+    }
+}
 
-    da_push(world_manager->free_slots, world_index);
+/* Not thread-safe, call it before handing work to other threads */
+int
+ecs_entity_manager_reserve_capacity(ecs_entity_manager *entity_manager, size_t count)
+{
+    size_t used;
 
-    for(entity_index = 0;
-        entity_index < world->entity_manager.cap;
-        ++entity_index)
+    used = entity_manager->reserved_count;
+    if(used > entity_manager->reserved_cap)
     {
-        ecs_entity *entity;
+        used = entity_manager->reserved_cap;
+    }
 
-        entity = &(world->entity_manager.entities[entity_index]);
-        if(entity->destroyed)
-        {
-            continue;
-        }
+    return(ecs_mem_reserve((void **)&entity_manager->reserved, &entity_manager->reserved_cap,
+                           used + count, sizeof(size_t)));
+}
+
+/* Lock-free, safe to call from any number of threads as long as nothing else
+   touches the entity manager meanwhile. Returns 0 once the reserved capacity
+   is used up. */
+size_t
+ecs_entity_manager_reserve(ecs_entity_manager *entity_manager)
+{
+    size_t slot, entity_id;
+
+    slot = ecs_atomic_add(&entity_manager->reserved_count, 1);
+    if(slot >= entity_manager->reserved_cap)
+    {
+        return(0);
+    }
+
+    entity_id = ecs_atomic_add(&entity_manager->current_id, 1) + 1;
+    entity_manager->reserved[slot] = entity_id;
+
+    return(entity_id);
+}
+
+void
+ecs_entity_manager_reserved_flush(ecs_entity_manager *entity_manager)
+{
+    size_t i, count;
+
+    count = entity_manager->reserved_count;
+    if(count > entity_manager->reserved_cap)
+    {
+        count = entity_manager->reserved_cap;
+    }
+
+    for(i = 0;
+        i < count;
+        ++i)
+    {
+        ecs_entity_manager_insert(entity_manager, entity_manager->reserved[i]);
+    }
+
+    entity_manager->reserved_count = 0;
+}
+
+/* Moves the live entities to the front of the table in id order, which is
+   the order a world without churn has, and rebuilds both maps */
+int
+ecs_entity_manager_defragment(ecs_entity_manager *entity_manager)
+{
+    size_t *slots, *ids, *indices, *order;
+    ecs_entity *entities;
+    size_t length, count, i;
+
+    length = da_len(entity_manager->entities);
+    slots = (size_t *)ecs_malloc((length + 1)*sizeof(size_t));
+    ids = (size_t *)ecs_malloc((length + 1)*sizeof(size_t));
+    indices = (size_t *)ecs_malloc((2*length + 1)*sizeof(size_t));
+    if(!slots || !ids || !indices)
+    {
+        ecs_free(slots);
+        ecs_free(ids);
+        ecs_free(indices);
+        return(0);
+    }
+
+    count = 0;
+    for(i = 0;
+        i < length;
+        ++i)
+    {
+        ecs_entity *entity;
+
+        entity = &(entity_manager->entities[i]);
+        if(entity->destroyed)
+        {
+            /* The mask went with the entity, a child list may be left */
+            da_free(entity->children);
+            continue;
+        }
+
+        slots[count] = i;
+        ids[count] = entity->id;
+        ++count;
+    }
+
+    order = ecs_sort_order(ids, count, sizeof(size_t), ecs_ids_compare, indices);
+
+    entities = 0;
+    for(i = 0;
+        i < count;
+        ++i)
+    {
+        da_push(entities, entity_manager->entities[slots[order[i]]]);
+    }
+
+    da_free(entity_manager->entities);
+    da_free(entity_manager->free_slots);
+    da_free(entity_manager->disabled);
+    entity_manager->entities = entities;
+    entity_manager->free_slots = 0;
+    entity_manager->disabled = 0;
+    entity_manager->cap = count;
+
+    for(i = 0;
+        i < count;
+        ++i)
+    {
+        if(entities[i].disabled)
+        {
+            entity_manager->disabled = ecs_mask_grow(entity_manager->disabled, i);
+            ecs_mask_set(entity_manager->disabled, i);
+        }
+    }
+
+    ecs_map_free(&entity_manager->id_to_index);
+    ecs_map_free(&entity_manager->index_to_id);
+    ecs_map_reserve(&entity_manager->id_to_index, count);
+    ecs_map_reserve(&entity_manager->index_to_id, count);
+    for(i = 0;
+        i < count;
+        ++i)
+    {
+        ecs_map_add(&entity_manager->id_to_index, entities[i].id, i);
+        ecs_map_add(&entity_manager->index_to_id, i, entities[i].id);
+    }
+
+    ecs_free(slots);
+    ecs_free(ids);
+    ecs_free(indices);
+
+    return(1);
+}
+
+void
+ecs_entity_manager_destroy(
+    ecs_entity_manager *entity_manager,
+    size_t entity_id)
+{
+    size_t *entity_index_ptr, entity_index;
+    ecs_entity *entity;
+
+    entity_index_ptr = ecs_map_get(&entity_manager->id_to_index, entity_id);
+    if(!entity_index_ptr)
+    {
+        return;
+    }
+
+    entity_index = *entity_index_ptr;
+    entity = &(entity_manager->entities[entity_index]);
+
+    da_push(entity_manager->free_slots, entity_index);
+    ecs_map_unset(&entity_manager->id_to_index, entity_id);
+    ecs_map_unset(&entity_manager->index_to_id, entity_index);
+
+    /* The slot is overwritten when it is reused */
+    da_free(entity->component_mask);
+    da_free(entity->disabled_mask);
+    entity->component_mask = 0;
+    entity->disabled_mask = 0;
+    entity->destroyed = 1;
+    ecs_mask_clear(entity_manager->disabled, da_len(entity_manager->disabled), entity_index);
+}
+
+ecs_entity*
+ecs_entity_manager_get_at(
+    ecs_entity_manager *entity_manager,
+    size_t index)
+{
+    if(index >= da_len(entity_manager->entities))
+    {
+        return(0);
+    }
+
+    return(&(entity_manager->entities[index]));
+}
+
+ecs_entity*
+ecs_entity_manager_get(
+    ecs_entity_manager *entity_manager,
+    size_t entity_id)
+{
+    size_t *entity_index_ptr, entity_index;
+
+    entity_index_ptr = ecs_map_get(&entity_manager->id_to_index, entity_id);
+    if(!entity_index_ptr)
+    {
+        return(0);
+    }
+
+    entity_index = *entity_index_ptr;
+    return(ecs_entity_manager_get_at(entity_manager, entity_index));
+}
+
+/* Component list */
+
+typedef struct
+ecs_component_list
+{
+    size_t id;
+
+    ecs_map entity_to_index;
+
+    int destroyed;
+
+    /* Zero for tags, which only exist as a bit in the entity mask */
+    size_t unit_size;
+
+    /* Rows of variable-size components are ecs_blob, the bytes live in the world slab */
+    int variable;
+    size_t count;
+    size_t cap;
+    void *data;
+
+    /* Double-buffered lists keep the previous update in data_prev, with the
+       same rows and cap as data. The two are swapped by ecs_update, which
+       also copies data_prev into data when refresh is set. */
+    int buffered;
+    int refresh;
+    void *data_prev;
+
+    /* Entity id of each row, kept parallel to data */
+    size_t *entities;
+
+    /* Bit per row, set when the component or its entity is disabled. The
+       bits move with the rows, disabled_count is the number set. */
+    size_t *disabled;
+    size_t disabled_count;
+
+    /* Order the rows were last sorted by, rows added since are out of place */
+    ecs_compare_function sort_compare;
+} ecs_component_list;
+
+int
+ecs_component_list_row_disabled(ecs_component_list *component_list, size_t index)
+{
+    return(ecs_mask_test(component_list->disabled, da_len(component_list->disabled), index));
+}
+
+void
+ecs_component_list_row_disable(
+    ecs_component_list *component_list,
+    size_t index,
+    int disabled)
+{
+    if(ecs_component_list_row_disabled(component_list, index) == (disabled != 0))
+    {
+        return;
+    }
+
+    if(disabled)
+    {
+        component_list->disabled = ecs_mask_grow(component_list->disabled, index);
+        ecs_mask_set(component_list->disabled, index);
+        component_list->disabled_count += 1;
+    }
+    else
+    {
+        ecs_mask_clear(component_list->disabled, da_len(component_list->disabled), index);
+        component_list->disabled_count -= 1;
+    }
+}
+
+/* Rebuilds the bits after a gather where row i came from row order[i] */
+void
+ecs_component_list_disabled_gather(
+    ecs_component_list *component_list,
+    size_t *order,
+    size_t count)
+{
+    size_t *disabled, i;
+
+    if(!component_list->disabled_count)
+    {
+        return;
+    }
+
+    disabled = 0;
+    for(i = 0;
+        i < count;
+        ++i)
+    {
+        if(ecs_component_list_row_disabled(component_list, order[i]))
+        {
+            disabled = ecs_mask_grow(disabled, i);
+            ecs_mask_set(disabled, i);
+        }
+    }
+
+    da_free(component_list->disabled);
+    component_list->disabled = disabled;
+}
+
+void*
+ecs_component_list_get_at(
+    ecs_component_list *component_list,
+    size_t index)
+{
+    if(index >= component_list->count)
+    {
+        return(0);
+    }
+
+    return((void *)((unsigned char *)component_list->data + index*component_list->unit_size));
+}
+
+void*
+ecs_component_list_get_prev_at(
+    ecs_component_list *component_list,
+    size_t index)
+{
+    if(index >= component_list->count || !component_list->buffered)
+    {
+        return(0);
+    }
+
+    return((void *)((unsigned char *)component_list->data_prev + index*component_list->unit_size));
+}
+
+/* Grows or shrinks both columns, cap only changes once both fit */
+int
+ecs_component_list_resize(
+    ecs_component_list *component_list,
+    size_t cap)
+{
+    void *data;
+
+    data = ecs_realloc(component_list->data, cap*component_list->unit_size);
+    if(!data)
+    {
+        return(0);
+    }
+
+    component_list->data = data;
+
+    if(component_list->buffered)
+    {
+        data = ecs_realloc(component_list->data_prev, cap*component_list->unit_size);
+        if(!data)
+        {
+            if(cap < component_list->cap)
+            {
+                component_list->cap = cap;
+            }
+
+            return(0);
+        }
+
+        component_list->data_prev = data;
+    }
+
+    component_list->cap = cap;
+
+    return(1);
+}
+
+void*
+ecs_component_list_get(
+    ecs_component_list *component_list,
+    size_t entity_id)
+{
+    size_t *index;
+
+    if(component_list->unit_size == 0)
+    {
+        /* Tags have no data */
+        return(0);
+    }
+
+    index = ecs_map_get(&component_list->entity_to_index, entity_id);
+    if(!index)
+    {
+        return(0);
+    }
+
+    return(ecs_component_list_get_at(component_list, *index));
+}
+
+void*
+ecs_component_list_get_prev(
+    ecs_component_list *component_list,
+    size_t entity_id)
+{
+    size_t *index;
+
+    if(!component_list->buffered)
+    {
+        return(0);
+    }
+
+    index = ecs_map_get(&component_list->entity_to_index, entity_id);
+    if(!index)
+    {
+        return(0);
+    }
+
+    return(ecs_component_list_get_prev_at(component_list, *index));
+}
+
+/* The bytes that hold the value of a row, out of line for variable-size components */
+void*
+ecs_component_list_row_bytes(
+    ecs_component_list *component_list,
+    size_t entity_id,
+    size_t *size)
+{
+    void *row;
+
+    *size = 0;
+    row = ecs_component_list_get(component_list, entity_id);
+    if(!row)
+    {
+        return(0);
+    }
+
+    if(component_list->variable)
+    {
+        *size = ((ecs_blob *)row)->size;
+        return(((ecs_blob *)row)->data);
+    }
+
+    *size = component_list->unit_size;
+
+    return(row);
+}
+
+void
+ecs_component_list_add(
+    ecs_component_list *component_list,
+    size_t entity_id,
+    void *component)
+{
+    size_t index;
+    void *src, *dst;
+
+    if(component_list->unit_size == 0)
+    {
+        /* Tags only live in the entity mask */
+        return;
+    }
+
+    if(ecs_map_get(&component_list->entity_to_index, entity_id))
+    {
+        /* Component already assigned to this entity */
+        return;
+    }
+
+    index = component_list->count;
+
+    if(component_list->cap <= component_list->count)
+    {
+        if(!ecs_component_list_resize(component_list, component_list->cap*2 + 1))
+        {
+            return;
+        }
+    }
+
+    ecs_map_set(&component_list->entity_to_index, entity_id, index);
+    da_push(component_list->entities, entity_id);
+
+    component_list->count += 1;
+    ecs_component_list_row_disable(component_list, index, 0);
+
+    dst = ecs_component_list_get_at(component_list, index);
+    if(component)
+    {
+        src = (void *)((unsigned char *)component);
+        ecs_mem_copy(src, dst, component_list->unit_size);
+    }
+    else
+    {
+        ecs_mem_zero(dst, component_list->unit_size);
+    }
+
+    /* A new row has the same value in both updates */
+    if(component_list->buffered)
+    {
+        ecs_mem_copy(dst, ecs_component_list_get_prev_at(component_list, index), component_list->unit_size);
+    }
+}
+
+void
+ecs_component_list_remove(
+    ecs_component_list *component_list,
+    size_t entity_id)
+{
+    size_t *index_ptr, index, last_index, last_entity;
+    void *src, *dst;
+
+    if(!component_list->count)
+    {
+        return;
+    }
+
+    index_ptr = ecs_map_get(&component_list->entity_to_index, entity_id);
+    if(!index_ptr)
+    {
+        /* Entity does not have this component */
+        return;
+    }
+
+    index = *index_ptr;
+    last_index = component_list->count - 1;
+
+    src = ecs_component_list_get_at(component_list, last_index);
+    dst = ecs_component_list_get_at(component_list, index);
+    ecs_mem_copy(src, dst, component_list->unit_size);
+
+    if(component_list->buffered)
+    {
+        src = ecs_component_list_get_prev_at(component_list, last_index);
+        dst = ecs_component_list_get_prev_at(component_list, index);
+        ecs_mem_copy(src, dst, component_list->unit_size);
+    }
+
+    ecs_component_list_row_disable(component_list, index, ecs_component_list_row_disabled(component_list, last_index));
+    ecs_component_list_row_disable(component_list, last_index, 0);
+
+    last_entity = component_list->entities[last_index];
+    component_list->entities[index] = last_entity;
+    da_pop(component_list->entities);
+
+    ecs_map_unset(&component_list->entity_to_index, entity_id);
+    if(last_entity != entity_id)
+    {
+        ecs_map_set(&component_list->entity_to_index, last_entity, index);
+    }
+
+    component_list->count -= 1;
+}
+
+void
+ecs_component_list_entity_destroyed(
+    ecs_component_list *component_list,
+    size_t entity_id)
+{
+    ecs_component_list_remove(component_list, entity_id);
+}
+
+void
+ecs_component_list_reindex(
+    ecs_component_list *component_list,
+    size_t first_index,
+    size_t last_index)
+{
+    size_t index;
+
+    for(index = first_index;
+        index <= last_index;
+        ++index)
+    {
+        ecs_map_set(&component_list->entity_to_index, component_list->entities[index], index);
+    }
+}
+
+/* Insertion sort, linear when only a few rows are out of place */
+int
+ecs_component_list_sort_insertion(
+    ecs_component_list *component_list,
+    ecs_compare_function compare)
+{
+    size_t i, j, first_moved, last_moved;
+    size_t unit_size, entity_id;
+    unsigned char *data, *row;
+    int disabled;
+
+    unit_size = component_list->unit_size;
+    data = (unsigned char *)component_list->data;
+
+    row = (unsigned char *)ecs_malloc(unit_size);
+    if(!row)
+    {
+        return(0);
+    }
+
+    first_moved = component_list->count;
+    last_moved = 0;
+    for(i = 1;
+        i < component_list->count;
+        ++i)
+    {
+        if(compare(data + (i - 1)*unit_size, data + i*unit_size) <= 0)
+        {
+            continue;
+        }
+
+        ecs_mem_copy(data + i*unit_size, row, unit_size);
+        entity_id = component_list->entities[i];
+        disabled = ecs_component_list_row_disabled(component_list, i);
+
+        j = i;
+        while(j > 0 && compare(data + (j - 1)*unit_size, row) > 0)
+        {
+            ecs_mem_copy(data + (j - 1)*unit_size, data + j*unit_size, unit_size);
+            component_list->entities[j] = component_list->entities[j - 1];
+            ecs_component_list_row_disable(component_list, j, ecs_component_list_row_disabled(component_list, j - 1));
+            --j;
+        }
+
+        ecs_mem_copy(row, data + j*unit_size, unit_size);
+        component_list->entities[j] = entity_id;
+        ecs_component_list_row_disable(component_list, j, disabled);
+
+        if(j < first_moved)
+        {
+            first_moved = j;
+        }
+
+        last_moved = i;
+    }
+
+    if(first_moved < component_list->count)
+    {
+        ecs_component_list_reindex(component_list, first_moved, last_moved);
+    }
+
+    ecs_free(row);
+
+    return(1);
+}
+
+/* Stable bottom-up merge sort of row indices followed by a single gather */
+int
+ecs_component_list_sort_merge(
+    ecs_component_list *component_list,
+    ecs_compare_function compare)
+{
+    size_t count, unit_size, i;
+    size_t *indices, *order, *scratch;
+    unsigned char *data, *sorted, *sorted_prev;
+
+    count = component_list->count;
+    unit_size = component_list->unit_size;
+    data = (unsigned char *)component_list->data;
+
+    indices = (size_t *)ecs_malloc(2*count*sizeof(size_t));
+    sorted = (unsigned char *)ecs_malloc(component_list->cap*unit_size);
+    sorted_prev = 0;
+    if(component_list->buffered)
+    {
+        sorted_prev = (unsigned char *)ecs_malloc(component_list->cap*unit_size);
+    }
+
+    if(!indices || !sorted || (component_list->buffered && !sorted_prev))
+    {
+        ecs_free(indices);
+        ecs_free(sorted);
+        ecs_free(sorted_prev);
+        return(0);
+    }
+
+    order = ecs_sort_order(data, count, unit_size, compare, indices);
+    scratch = (order == indices) ? indices + count : indices;
+
+    for(i = 0;
+        i < count;
+        ++i)
+    {
+        ecs_mem_copy(data + order[i]*unit_size, sorted + i*unit_size, unit_size);
+        if(sorted_prev)
+        {
+            ecs_mem_copy((unsigned char *)component_list->data_prev + order[i]*unit_size,
+                         sorted_prev + i*unit_size, unit_size);
+        }
+
+        scratch[i] = component_list->entities[order[i]];
+    }
+
+    for(i = 0;
+        i < count;
+        ++i)
+    {
+        component_list->entities[i] = scratch[i];
+    }
+
+    ecs_component_list_disabled_gather(component_list, order, count);
+
+    ecs_free(component_list->data);
+    component_list->data = sorted;
+
+    if(sorted_prev)
+    {
+        ecs_free(component_list->data_prev);
+        component_list->data_prev = sorted_prev;
+    }
+
+    ecs_free(indices);
+
+    if(count > 0)
+    {
+        ecs_component_list_reindex(component_list, 0, count - 1);
+    }
+
+    return(1);
+}
+
+void
+ecs_component_list_sort(
+    ecs_component_list *component_list,
+    ecs_compare_function compare)
+{
+    int sorted;
+
+    if(!compare || component_list->unit_size == 0 || component_list->count < 2)
+    {
+        component_list->sort_compare = compare;
+        return;
+    }
+
+    /* Already sorted by this order, only what changed since needs to move.
+       Insertion moves rows one column at a time, so double-buffered lists
+       always take the merge path that gathers both columns. */
+    if(component_list->sort_compare == compare && !component_list->buffered)
+    {
+        sorted = ecs_component_list_sort_insertion(component_list, compare);
+    }
+    else
+    {
+        sorted = ecs_component_list_sort_merge(component_list, compare);
+    }
+
+    component_list->sort_compare = sorted ? compare : 0;
+}
+
+/* Starts keeping the previous update, both columns begin with the current rows */
+int
+ecs_component_list_buffer(ecs_component_list *component_list)
+{
+    /* Both columns would point at the same out-of-line bytes */
+    if(component_list->unit_size == 0 || component_list->variable)
+    {
+        return(0);
+    }
+
+    if(component_list->buffered)
+    {
+        return(1);
+    }
+
+    if(component_list->cap)
+    {
+        component_list->data_prev = ecs_mem_clone(component_list->data,
+                                                  component_list->cap*component_list->unit_size,
+                                                  component_list->count*component_list->unit_size);
+        if(!component_list->data_prev)
+        {
+            return(0);
+        }
+    }
+
+    component_list->buffered = 1;
+
+    return(1);
+}
+
+/* What was written becomes the previous update. Refreshed lists then copy
+   it into the write column so rows left untouched keep their value. */
+void
+ecs_component_list_swap(ecs_component_list *component_list)
+{
+    void *data;
+
+    if(!component_list->buffered)
+    {
+        return;
+    }
+
+    data = component_list->data;
+    component_list->data = component_list->data_prev;
+    component_list->data_prev = data;
+
+    if(component_list->refresh)
+    {
+        ecs_mem_copy(component_list->data_prev, component_list->data,
+                     component_list->count*component_list->unit_size);
+    }
+}
+
+/* Component manager */
+
+typedef struct
+ecs_component_manager
+{
+    size_t current_id;
+    ecs_component_list *lists;
+    size_t cap;
+
+    ecs_map id_to_index;
+    ecs_map index_to_id;
+
+    size_t *free_slots;
+} ecs_component_manager;
+
+size_t
+ecs_component_manager_register(
+    ecs_component_manager *component_manager,
+    size_t component_size)
+{
+    size_t component_id, component_index;
+    ecs_component_list list = {0};
+    size_t free_slots_length;
+
+    /* TODO: Check index in free_slots first */
+    component_id = ++component_manager->current_id;
+    list.id = component_id;
+    list.unit_size = component_size;
+
+    free_slots_length = da_len(component_manager->free_slots);
+    if(free_slots_length > 0)
+    {
+        component_index = component_manager->free_slots[free_slots_length - 1];
+        da_pop(component_manager->free_slots);
+        component_manager->lists[component_index] = list;
+    }
+    else
+    {
+        component_index = da_len(component_manager->lists);
+        da_push(component_manager->lists, list);
+        component_manager->cap += 1;
+    }
+
+    ecs_map_set(&component_manager->id_to_index, component_id, component_index);
+    ecs_map_set(&component_manager->index_to_id, component_index, component_id);
+
+    return(component_id);
+}
+
+size_t
+ecs_component_list_memory(ecs_component_list *list)
+{
+    return(list->cap*list->unit_size*(list->buffered ? 2 : 1) +
+           (da_len(list->entities) + da_len(list->disabled))*sizeof(size_t) +
+           ecs_map_memory(&list->entity_to_index));
+}
+
+void
+ecs_component_list_compact(ecs_component_list *list)
+{
+    size_t *entities;
+
+    if(list->cap > list->count)
+    {
+        if(list->count == 0)
+        {
+            ecs_free(list->data);
+            ecs_free(list->data_prev);
+            list->data = 0;
+            list->data_prev = 0;
+            list->cap = 0;
+        }
+        else
+        {
+            ecs_component_list_resize(list, list->count);
+        }
+    }
+
+    entities = ecs_ids_clone(list->entities);
+    da_free(list->entities);
+    list->entities = entities;
+
+    entities = list->disabled_count ? ecs_ids_clone(list->disabled) : 0;
+    da_free(list->disabled);
+    list->disabled = entities;
+
+    ecs_map_compact(&list->entity_to_index);
+}
+
+void
+ecs_component_list_release(ecs_component_list *list)
+{
+    ecs_map_free(&list->entity_to_index);
+    da_free(list->entities);
+    da_free(list->disabled);
+    ecs_free(list->data);
+    ecs_free(list->data_prev);
+
+    list->entities = 0;
+    list->disabled = 0;
+    list->disabled_count = 0;
+    list->data = 0;
+    list->data_prev = 0;
+    list->count = 0;
+    list->cap = 0;
+}
+
+void
+ecs_component_list_release_job(size_t index, void *data)
+{
+    ecs_component_list *list;
+
+    list = &(((ecs_component_list *)data)[index]);
+    if(list->destroyed)
+    {
+        return;
+    }
+
+    ecs_component_list_release(list);
+    list->destroyed = 1;
+}
+
+/* Puts the rows back in entity id order with one gather per column */
+int
+ecs_component_list_defragment(ecs_component_list *component_list)
+{
+    size_t *indices, *order, *scratch;
+    unsigned char *data, *data_prev;
+    size_t count, unit_size, i;
+
+    count = component_list->count;
+    unit_size = component_list->unit_size;
+    if(unit_size == 0 || count < 2)
+    {
+        return(1);
+    }
+
+    for(i = 1;
+        i < count && component_list->entities[i - 1] < component_list->entities[i];
+        ++i)
+    {
+    }
+
+    if(i == count)
+    {
+        /* Already in order */
+        return(1);
+    }
+
+    indices = (size_t *)ecs_malloc(2*count*sizeof(size_t));
+    data = (unsigned char *)ecs_malloc(component_list->cap*unit_size);
+    data_prev = 0;
+    if(component_list->buffered)
+    {
+        data_prev = (unsigned char *)ecs_malloc(component_list->cap*unit_size);
+    }
+
+    if(!indices || !data || (component_list->buffered && !data_prev))
+    {
+        ecs_free(indices);
+        ecs_free(data);
+        ecs_free(data_prev);
+        return(0);
+    }
+
+    order = ecs_sort_order(component_list->entities, count, sizeof(size_t), ecs_ids_compare, indices);
+    scratch = (order == indices) ? indices + count : indices;
+    for(i = 0;
+        i < count;
+        ++i)
+    {
+        ecs_mem_copy((unsigned char *)component_list->data + order[i]*unit_size, data + i*unit_size, unit_size);
+        if(data_prev)
+        {
+            ecs_mem_copy((unsigned char *)component_list->data_prev + order[i]*unit_size,
+                         data_prev + i*unit_size, unit_size);
+        }
+
+        scratch[i] = component_list->entities[order[i]];
+    }
+
+    ecs_component_list_disabled_gather(component_list, order, count);
+
+    ecs_map_free(&component_list->entity_to_index);
+    ecs_map_reserve(&component_list->entity_to_index, count);
+    for(i = 0;
+        i < count;
+        ++i)
+    {
+        component_list->entities[i] = scratch[i];
+        ecs_map_add(&component_list->entity_to_index, scratch[i], i);
+    }
+
+    ecs_free(component_list->data);
+    component_list->data = data;
+    if(data_prev)
+    {
+        ecs_free(component_list->data_prev);
+        component_list->data_prev = data_prev;
+    }
+
+    ecs_free(indices);
+
+    return(1);
+}
+
+void
+ecs_component_list_defragment_job(size_t index, void *data)
+{
+    ecs_component_list *list;
+
+    list = &(((ecs_component_list *)data)[index]);
+
+    /* Lists sorted with ecs_component_sort keep the order asked for */
+    if(list->destroyed || list->sort_compare)
+    {
+        return;
+    }
+
+    ecs_component_list_defragment(list);
+}
+
+void
+ecs_component_manager_unregister(
+    ecs_component_manager *component_manager,
+    size_t component_id)
+{
+    size_t *component_index_ptr, component_index;
+    ecs_component_list *list;
+
+    component_index_ptr = ecs_map_get(&component_manager->id_to_index, component_id);
+    if(!component_index_ptr)
+    {
+        return;
+    }
+
+    component_index = *component_index_ptr;
+    list = &(component_manager->lists[component_index]);
+
+    da_push(component_manager->free_slots, component_index);
+    ecs_map_unset(&component_manager->id_to_index, component_id);
+    ecs_map_unset(&component_manager->index_to_id, component_index);
+    ecs_component_list_release(list);
+
+    list->destroyed = 1;
+}
+
+ecs_component_list*
+ecs_component_manager_get_list(
+    ecs_component_manager *component_manager,
+    size_t component_id)
+{
+    size_t *list_index_ptr;
+    ecs_component_list *list;
+
+    list_index_ptr = ecs_map_get(&component_manager->id_to_index, component_id);
+    if(!list_index_ptr)
+    {
+        return(0);
+    }
+
+    list = &(component_manager->lists[*list_index_ptr]);
+    if(list->destroyed)
+    {
+        return(0);
+    }
+
+    return(list);
+}
+
+void
+ecs_component_manager_add(
+    ecs_component_manager *component_manager,
+    size_t entity_id,
+    size_t component_id)
+{
+    size_t *list_index_ptr, list_index;
+    ecs_component_list *list;
+
+    list_index_ptr = ecs_map_get(&component_manager->id_to_index, component_id);
+    if(!list_index_ptr)
+    {
+        return;
+    }
+
+    list_index = *list_index_ptr;
+    list = &(component_manager->lists[list_index]);
+
+    ecs_component_list_add(list, entity_id, 0);
+}
+
+void
+ecs_component_manager_remove(
+    ecs_component_manager *component_manager,
+    size_t entity_id,
+    size_t component_id)
+{
+    size_t *list_index_ptr, list_index;
+    ecs_component_list *list;
+
+    list_index_ptr = ecs_map_get(&component_manager->id_to_index, component_id);
+    if(!list_index_ptr)
+    {
+        return;
+    }
+
+    list_index = *list_index_ptr;
+    list = &(component_manager->lists[list_index]);
+
+    ecs_component_list_remove(list, entity_id);
+}
+
+void*
+ecs_component_manager_get(
+    ecs_component_manager *component_manager,
+    size_t entity_id,
+    size_t component_id)
+{
+    size_t *list_index_ptr, list_index;
+    ecs_component_list *list;
+
+    list_index_ptr = ecs_map_get(&component_manager->id_to_index, component_id);
+    if(!list_index_ptr)
+    {
+        return(0);
+    }
+
+    list_index = *list_index_ptr;
+    list = &(component_manager->lists[list_index]);
+
+    return(ecs_component_list_get(list, entity_id));
+}
+
+void
+ecs_component_manager_entity_destroyed(
+    ecs_component_manager *component_manager,
+    size_t entity_id)
+{
+    size_t lists_count;
+    size_t i;
+
+    lists_count = da_len(component_manager->lists);
+    for(i = 0;
+        i < lists_count;
+        ++i)
+    {
+        if(component_manager->lists[i].destroyed)
+        {
+            continue;
+        }
+
+        ecs_component_list_entity_destroyed(&(component_manager->lists[i]), entity_id);
+    }
+}
+
+/* Query signature */
+
+/* A run builds an id-indexed row table for a component list when the table
+   plus the list costs at most this many words per matched entity, and looks
+   each row up in the list's map otherwise */
+#ifndef ECS_QUERY_TABLE_RATIO
+#define ECS_QUERY_TABLE_RATIO 4
+#endif
+
+typedef struct
+ecs_query_signature
+{
+    /* Component bits a matching entity must have, same layout as the entity mask */
+    size_t *mask;
+    size_t mask_size;
+    size_t mask_cap;
+
+    /* Distinct components sorted by id */
+    size_t *components_ids;
+    size_t components_count;
+    size_t components_cap;
+
+    /* Result column order, column i holds components_ids[columns[i]] */
+    size_t *columns;
+    size_t columns_count;
+    size_t columns_cap;
+
+    /* Component lists and their row tables resolved once per run. A table
+       holds row + 1 by entity id, a list without one is looked up per row. */
+    ecs_component_list **lists;
+    size_t lists_cap;
+    size_t **tables;
+    size_t tables_cap;
+    size_t *table_words;
+    size_t table_words_cap;
+
+    /* Entity slot the next budgeted run starts from. Slots do not move when
+       rows are swap-removed, so the position survives structural changes. */
+    size_t cursor;
+
+    int destroyed;
+} ecs_query_signature;
+
+/* Keeps components_ids sorted and distinct, a repeated id gets a column of
+   its own that points at the same component */
+int
+ecs_query_signature_add(
+    ecs_query_signature *signature,
+    size_t component_id)
+{
+    size_t mask_index, position, i;
+
+    if(component_id == 0)
+    {
+        return(1);
+    }
+
+    mask_index = ECS_MASK_WORD(component_id - 1);
+    if(!ecs_mem_reserve((void **)&signature->mask, &signature->mask_cap, mask_index + 1, sizeof(size_t)))
+    {
+        return(0);
+    }
+
+    while(signature->mask_size <= mask_index)
+    {
+        signature->mask[signature->mask_size++] = 0;
+    }
+
+    ecs_mask_set(signature->mask, component_id - 1);
+
+    if(!ecs_mem_reserve((void **)&signature->columns, &signature->columns_cap,
+                        signature->columns_count + 1, sizeof(size_t)))
+    {
+        return(0);
+    }
+
+    position = 0;
+    while(position < signature->components_count && signature->components_ids[position] < component_id)
+    {
+        ++position;
+    }
+
+    if(position == signature->components_count || signature->components_ids[position] != component_id)
+    {
+        if(!ecs_mem_reserve((void **)&signature->components_ids, &signature->components_cap,
+                            signature->components_count + 1, sizeof(size_t)))
+        {
+            return(0);
+        }
+
+        /* The per-run tables are sized here so running a query never allocates for them */
+        if(!ecs_mem_reserve((void **)&signature->lists, &signature->lists_cap,
+                            signature->components_count + 1, sizeof(ecs_component_list *)) ||
+           !ecs_mem_reserve((void **)&signature->tables, &signature->tables_cap,
+                            signature->components_count + 1, sizeof(size_t *)))
+        {
+            return(0);
+        }
+
+        for(i = signature->components_count;
+            i > position;
+            --i)
+        {
+            signature->components_ids[i] = signature->components_ids[i - 1];
+        }
+
+        signature->components_ids[position] = component_id;
+        ++signature->components_count;
+
+        for(i = 0;
+            i < signature->columns_count;
+            ++i)
+        {
+            signature->columns[i] += (signature->columns[i] >= position);
+        }
+    }
+
+    signature->columns[signature->columns_count++] = position;
+
+    return(1);
+}
+
+int
+ecs_query_signature_compile(
+    ecs_query_signature *signature,
+    size_t num_components,
+    va_list args)
+{
+    size_t i;
+
+    signature->mask_size = 0;
+    signature->components_count = 0;
+    signature->columns_count = 0;
+
+    for(i = 0;
+        i < num_components;
+        ++i)
+    {
+        if(!ecs_query_signature_add(signature, va_arg(args, size_t)))
+        {
+            return(0);
+        }
+    }
+
+    return(1);
+}
+
+int
+ecs_query_signature_match(
+    ecs_query_signature *signature,
+    size_t *component_mask)
+{
+    return(ecs_mask_contains(component_mask, da_len(component_mask), signature->mask, signature->mask_size));
+}
+
+void
+ecs_query_signature_free(ecs_query_signature *signature)
+{
+    ecs_free(signature->mask);
+    ecs_free(signature->components_ids);
+    ecs_free(signature->columns);
+    ecs_free(signature->lists);
+    ecs_free(signature->tables);
+    ecs_free(signature->table_words);
+
+    signature->mask = 0;
+    signature->mask_size = 0;
+    signature->mask_cap = 0;
+    signature->components_ids = 0;
+    signature->components_count = 0;
+    signature->components_cap = 0;
+    signature->columns = 0;
+    signature->columns_count = 0;
+    signature->columns_cap = 0;
+    signature->lists = 0;
+    signature->lists_cap = 0;
+    signature->tables = 0;
+    signature->tables_cap = 0;
+    signature->table_words = 0;
+    signature->table_words_cap = 0;
+}
+
+/* Resource */
+
+typedef struct
+ecs_resource
+{
+    size_t size;
+    void *data;
+    int destroyed;
+} ecs_resource;
+
+/* Event channel */
+
+typedef struct
+ecs_event_channel
+{
+    size_t event_size;
+    unsigned char *data;
+    size_t cap;
+
+    /* Slots asked for this frame, bumped atomically, may run past cap */
+    size_t count;
+
+    /* Slots of the reservations that fit, always at most cap. They form a
+       prefix since every reservation after the first that fails fails too. */
+    size_t committed;
+
+    int destroyed;
+} ecs_event_channel;
+
+/* Spatial index */
+
+#ifndef ECS_SPATIAL_BUCKETS
+#define ECS_SPATIAL_BUCKETS 4096 /* Must be a power of two */
+#endif
+
+typedef struct
+ecs_spatial_entry
+{
+    size_t entity_id;
+    float position[3];
+} ecs_spatial_entry;
+
+typedef struct
+ecs_spatial_index
+{
+    size_t component_id;
+    size_t offset;
+    size_t dimensions;
+    float cell_size;
+
+    /* Uniform grid hashed into a fixed number of buckets. Entries keep a copy
+       of the position so queries never touch the component storage. */
+    ecs_spatial_entry **buckets;
+    ecs_map entity_to_bucket;
+
+    size_t *results;
+    size_t results_count;
+    size_t results_cap;
+
+    int destroyed;
+} ecs_spatial_index;
+
+long
+ecs_spatial_cell(ecs_spatial_index *index, float value)
+{
+    float cell;
+
+    cell = value / index->cell_size;
+
+    return((long)cell - (cell < (float)(long)cell));
+}
+
+size_t
+ecs_spatial_bucket(long x, long y, long z)
+{
+    size_t hash;
+
+    hash = ((size_t)x*73856093u) ^ ((size_t)y*19349663u) ^ ((size_t)z*83492791u);
+
+    return(hash & (ECS_SPATIAL_BUCKETS - 1));
+}
+
+size_t
+ecs_spatial_entry_bucket(ecs_spatial_index *index, ecs_spatial_entry *entry)
+{
+    return(ecs_spatial_bucket(ecs_spatial_cell(index, entry->position[0]),
+                              ecs_spatial_cell(index, entry->position[1]),
+                              ecs_spatial_cell(index, entry->position[2])));
+}
+
+void
+ecs_spatial_index_remove(ecs_spatial_index *index, size_t entity_id)
+{
+    size_t *bucket_index_ptr;
+    ecs_spatial_entry *bucket;
+    size_t i, bucket_length;
+
+    bucket_index_ptr = ecs_map_get(&index->entity_to_bucket, entity_id);
+    if(!bucket_index_ptr)
+    {
+        return;
+    }
+
+    bucket = index->buckets[*bucket_index_ptr];
+    bucket_length = da_len(bucket);
+    for(i = 0;
+        i < bucket_length;
+        ++i)
+    {
+        if(bucket[i].entity_id == entity_id)
+        {
+            bucket[i] = bucket[bucket_length - 1];
+            da_pop(bucket);
+            break;
+        }
+    }
+
+    ecs_map_unset(&index->entity_to_bucket, entity_id);
+}
+
+void
+ecs_spatial_index_update(
+    ecs_spatial_index *index,
+    size_t entity_id,
+    void *component)
+{
+    ecs_spatial_entry entry = {0};
+    size_t *bucket_index_ptr, bucket_index;
+    float *position;
+    size_t i;
+
+    if(!component)
+    {
+        return;
+    }
+
+    entry.entity_id = entity_id;
+    position = (float *)((unsigned char *)component + index->offset);
+    for(i = 0;
+        i < index->dimensions;
+        ++i)
+    {
+        entry.position[i] = position[i];
+    }
+
+    bucket_index = ecs_spatial_entry_bucket(index, &entry);
+
+    bucket_index_ptr = ecs_map_get(&index->entity_to_bucket, entity_id);
+    if(bucket_index_ptr && *bucket_index_ptr == bucket_index)
+    {
+        /* Still in the same bucket, only the position copy changes */
+        ecs_spatial_entry *bucket;
+
+        bucket = index->buckets[bucket_index];
+        for(i = 0;
+            i < da_len(bucket);
+            ++i)
+        {
+            if(bucket[i].entity_id == entity_id)
+            {
+                bucket[i] = entry;
+                return;
+            }
+        }
+    }
+
+    ecs_spatial_index_remove(index, entity_id);
+    da_push(index->buckets[bucket_index], entry);
+    ecs_map_set(&index->entity_to_bucket, entity_id, bucket_index);
+}
+
+void
+ecs_spatial_index_free(ecs_spatial_index *index)
+{
+    size_t i;
+
+    if(index->buckets)
+    {
+        for(i = 0;
+            i < ECS_SPATIAL_BUCKETS;
+            ++i)
+        {
+            da_free(index->buckets[i]);
+        }
+    }
+
+    ecs_free(index->buckets);
+    ecs_map_free(&index->entity_to_bucket);
+    ecs_free(index->results);
+
+    index->buckets = 0;
+    index->results = 0;
+    index->results_count = 0;
+    index->results_cap = 0;
+}
+
+int
+ecs_spatial_index_collect(
+    ecs_spatial_index *index,
+    ecs_spatial_entry *bucket,
+    float *min, float *max,
+    float *center, float radius_squared,
+    long x, long y, long z,
+    int check_cell)
+{
+    size_t i, j;
+
+    for(i = 0;
+        i < da_len(bucket);
+        ++i)
+    {
+        ecs_spatial_entry *entry;
+        int inside;
+
+        entry = &(bucket[i]);
+
+        /* Several cells can share a bucket, only report entries from the visited cell */
+        if(check_cell &&
+           (ecs_spatial_cell(index, entry->position[0]) != x ||
+            ecs_spatial_cell(index, entry->position[1]) != y ||
+            ecs_spatial_cell(index, entry->position[2]) != z))
+        {
+            continue;
+        }
+
+        inside = 1;
+        if(center)
+        {
+            float distance_squared;
+
+            distance_squared = 0.0f;
+            for(j = 0;
+                j < index->dimensions;
+                ++j)
+            {
+                float d;
+
+                d = entry->position[j] - center[j];
+                distance_squared += d*d;
+            }
+
+            inside = (distance_squared <= radius_squared);
+        }
+        else
+        {
+            for(j = 0;
+                j < index->dimensions;
+                ++j)
+            {
+                if(entry->position[j] < min[j] || entry->position[j] > max[j])
+                {
+                    inside = 0;
+                    break;
+                }
+            }
+        }
+
+        if(!inside)
+        {
+            continue;
+        }
+
+        if(!ecs_mem_reserve((void **)&index->results, &index->results_cap, index->results_count + 1, sizeof(size_t)))
+        {
+            return(0);
+        }
+
+        index->results[index->results_count++] = entry->entity_id;
+    }
+
+    return(1);
+}
+
+size_t*
+ecs_spatial_index_query(
+    ecs_spatial_index *index,
+    float *min, float *max,
+    float *center, float radius,
+    size_t *count)
+{
+    long cell_min[3], cell_max[3];
+    long x, y, z;
+    size_t i;
+    float cells;
+
+    index->results_count = 0;
+    *count = 0;
+
+    cells = 1.0f;
+    for(i = 0;
+        i < 3;
+        ++i)
+    {
+        cell_min[i] = 0;
+        cell_max[i] = 0;
+        if(i < index->dimensions)
+        {
+            cell_min[i] = ecs_spatial_cell(index, min[i]);
+            cell_max[i] = ecs_spatial_cell(index, max[i]);
+            cells *= (float)(cell_max[i] - cell_min[i] + 1);
+        }
+    }
+
+    if(cells > (float)ECS_SPATIAL_BUCKETS)
+    {
+        /* The range covers more cells than there are buckets, scan each bucket once */
+        for(i = 0;
+            i < ECS_SPATIAL_BUCKETS;
+            ++i)
+        {
+            if(!ecs_spatial_index_collect(index, index->buckets[i], min, max, center, radius*radius, 0, 0, 0, 0))
+            {
+                return(0);
+            }
+        }
+    }
+    else
+    {
+        for(z = cell_min[2];
+            z <= cell_max[2];
+            ++z)
+        {
+            for(y = cell_min[1];
+                y <= cell_max[1];
+                ++y)
+            {
+                for(x = cell_min[0];
+                    x <= cell_max[0];
+                    ++x)
+                {
+                    if(!ecs_spatial_index_collect(index, index->buckets[ecs_spatial_bucket(x, y, z)],
+                                                  min, max, center, radius*radius, x, y, z, 1))
+                    {
+                        return(0);
+                    }
+                }
+            }
+        }
+    }
+
+    *count = index->results_count;
+
+    return(index->results);
+}
+
+/* Key index */
+
+#ifndef ECS_KEY_MIN_BUCKETS
+#define ECS_KEY_MIN_BUCKETS 16 /* Must be a power of two */
+#endif
+
+#ifndef ECS_KEY_MAX_SIZE
+#define ECS_KEY_MAX_SIZE 16
+#endif
+
+typedef struct
+ecs_key_entry
+{
+    size_t entity_id;
+    size_t hash;
+    unsigned char key[ECS_KEY_MAX_SIZE];
+} ecs_key_entry;
+
+typedef struct
+ecs_key_index
+{
+    size_t component_id;
+    size_t offset;
+    size_t key_size;
+    int unique;
+
+    /* Hashed buckets holding a copy of each key, lookups never touch the
+       component storage. The table doubles past 3/4 entries per bucket. */
+    ecs_key_entry **buckets;
+    size_t bucket_count;
+    size_t count;
+    ecs_map entity_to_bucket;
+
+    size_t *results;
+    size_t results_count;
+    size_t results_cap;
+
+    int destroyed;
+} ecs_key_index;
+
+/* FNV-1a */
+size_t
+ecs_key_hash(unsigned char *key, size_t key_size)
+{
+    size_t hash, i;
+
+    hash = (size_t)2166136261u;
+    for(i = 0;
+        i < key_size;
+        ++i)
+    {
+        hash ^= key[i];
+        hash *= 16777619u;
+    }
+
+    return(hash);
+}
+
+int
+ecs_key_equal(unsigned char *a, unsigned char *b, size_t key_size)
+{
+    size_t i;
+
+    for(i = 0;
+        i < key_size;
+        ++i)
+    {
+        if(a[i] != b[i])
+        {
+            return(0);
+        }
+    }
+
+    return(1);
+}
+
+size_t
+ecs_key_index_buckets_for(size_t count)
+{
+    size_t bucket_count;
+
+    bucket_count = ECS_KEY_MIN_BUCKETS;
+    while(bucket_count*3 < count*4)
+    {
+        bucket_count *= 2;
+    }
+
+    return(bucket_count);
+}
+
+/* Moves every entry into a table of bucket_count buckets, entries sharing a
+   key keep their relative order. The old table stays on failure. */
+int
+ecs_key_index_rehash(ecs_key_index *index, size_t bucket_count)
+{
+    ecs_key_entry **buckets;
+    size_t i, j, bucket_index;
+
+    buckets = (ecs_key_entry **)ecs_malloc(bucket_count*sizeof(ecs_key_entry *));
+    if(!buckets)
+    {
+        return(0);
+    }
+
+    ecs_mem_zero(buckets, bucket_count*sizeof(ecs_key_entry *));
+    for(i = 0;
+        i < index->bucket_count;
+        ++i)
+    {
+        for(j = 0;
+            j < da_len(index->buckets[i]);
+            ++j)
+        {
+            bucket_index = index->buckets[i][j].hash & (bucket_count - 1);
+            da_push(buckets[bucket_index], index->buckets[i][j]);
+            ecs_map_set(&index->entity_to_bucket, index->buckets[i][j].entity_id, bucket_index);
+        }
+
+        da_free(index->buckets[i]);
+    }
+
+    ecs_free(index->buckets);
+    index->buckets = buckets;
+    index->bucket_count = bucket_count;
+
+    return(1);
+}
+
+ecs_key_entry*
+ecs_key_index_entry(ecs_key_index *index, size_t entity_id)
+{
+    size_t *bucket_index_ptr;
+    ecs_key_entry *bucket;
+    size_t i;
+
+    bucket_index_ptr = ecs_map_get(&index->entity_to_bucket, entity_id);
+    if(!bucket_index_ptr)
+    {
+        return(0);
+    }
+
+    bucket = index->buckets[*bucket_index_ptr];
+    for(i = 0;
+        i < da_len(bucket);
+        ++i)
+    {
+        if(bucket[i].entity_id == entity_id)
+        {
+            return(&bucket[i]);
+        }
+    }
+
+    return(0);
+}
+
+/* First entity indexed under the key, 0 if none */
+size_t
+ecs_key_index_holder(ecs_key_index *index, unsigned char *key, size_t hash)
+{
+    ecs_key_entry *bucket;
+    size_t i;
+
+    bucket = index->buckets[hash & (index->bucket_count - 1)];
+    for(i = 0;
+        i < da_len(bucket);
+        ++i)
+    {
+        if(bucket[i].hash == hash && ecs_key_equal(bucket[i].key, key, index->key_size))
+        {
+            return(bucket[i].entity_id);
+        }
+    }
+
+    return(0);
+}
+
+void
+ecs_key_index_remove(ecs_key_index *index, size_t entity_id)
+{
+    size_t *bucket_index_ptr;
+    ecs_key_entry *bucket;
+    size_t i, bucket_length;
+
+    bucket_index_ptr = ecs_map_get(&index->entity_to_bucket, entity_id);
+    if(!bucket_index_ptr)
+    {
+        return;
+    }
+
+    /* Shifts the tail down so the bucket stays in write order */
+    bucket = index->buckets[*bucket_index_ptr];
+    bucket_length = da_len(bucket);
+    for(i = 0;
+        i < bucket_length;
+        ++i)
+    {
+        if(bucket[i].entity_id == entity_id)
+        {
+            for(;
+                i + 1 < bucket_length;
+                ++i)
+            {
+                bucket[i] = bucket[i + 1];
+            }
+
+            da_pop(bucket);
+            --index->count;
+            break;
+        }
+    }
+
+    ecs_map_unset(&index->entity_to_bucket, entity_id);
+}
+
+/* Returns 0 when a unique index rejects the key because another entity
+   holds it. The key bytes in the component are then put back to the key the
+   entity is indexed under, an entity not indexed yet stays out. */
+int
+ecs_key_index_update(
+    ecs_key_index *index,
+    size_t entity_id,
+    void *component)
+{
+    ecs_key_entry entry = {0};
+    ecs_key_entry *previous;
+    size_t holder, bucket_index;
+
+    if(!component)
+    {
+        return(1);
+    }
+
+    entry.entity_id = entity_id;
+    ecs_mem_copy((unsigned char *)component + index->offset, entry.key, index->key_size);
+    entry.hash = ecs_key_hash(entry.key, index->key_size);
+
+    if(index->unique)
+    {
+        holder = ecs_key_index_holder(index, entry.key, entry.hash);
+        if(holder && holder != entity_id)
+        {
+            previous = ecs_key_index_entry(index, entity_id);
+            if(previous)
+            {
+                ecs_mem_copy(previous->key, (unsigned char *)component + index->offset, index->key_size);
+            }
+
+            return(0);
+        }
+    }
+
+    /* Other holders of the key stay, the writer moves to the end */
+    ecs_key_index_remove(index, entity_id);
+    if((index->count + 1)*4 > index->bucket_count*3)
+    {
+        ecs_key_index_rehash(index, index->bucket_count*2);
+    }
+
+    bucket_index = entry.hash & (index->bucket_count - 1);
+    da_push(index->buckets[bucket_index], entry);
+    ecs_map_set(&index->entity_to_bucket, entity_id, bucket_index);
+    ++index->count;
+
+    return(1);
+}
+
+void
+ecs_key_index_free(ecs_key_index *index)
+{
+    size_t i;
+
+    if(index->buckets)
+    {
+        for(i = 0;
+            i < index->bucket_count;
+            ++i)
+        {
+            da_free(index->buckets[i]);
+        }
+    }
+
+    ecs_free(index->buckets);
+    ecs_map_free(&index->entity_to_bucket);
+    ecs_free(index->results);
+
+    index->buckets = 0;
+    index->bucket_count = 0;
+    index->count = 0;
+    index->results = 0;
+    index->results_count = 0;
+    index->results_cap = 0;
+}
+
+/* Results stay valid until the next lookup on the same index */
+size_t*
+ecs_key_index_lookup(ecs_key_index *index, void *key, size_t *count)
+{
+    ecs_key_entry *bucket;
+    size_t hash, i;
+
+    index->results_count = 0;
+
+    hash = ecs_key_hash((unsigned char *)key, index->key_size);
+    bucket = index->buckets[hash & (index->bucket_count - 1)];
+    for(i = 0;
+        i < da_len(bucket);
+        ++i)
+    {
+        if(bucket[i].hash != hash || !ecs_key_equal(bucket[i].key, (unsigned char *)key, index->key_size))
+        {
+            continue;
+        }
+
+        if(!ecs_mem_reserve((void **)&index->results, &index->results_cap, index->results_count + 1, sizeof(size_t)))
+        {
+            break;
+        }
+
+        index->results[index->results_count++] = bucket[i].entity_id;
+    }
+
+    *count = index->results_count;
+
+    return(index->results);
+}
+
+/* Observer */
+
+typedef struct
+ecs_observer
+{
+    size_t component_id;
+    int event;
+    ecs_observer_function callback;
+    void *user_data;
+
+    /* Entities queued since the last flush */
+    size_t *pending;
+    size_t pending_count;
+    size_t pending_cap;
+
+    int destroyed;
+} ecs_observer;
+
+/* System */
+
+/* Fixed steps run per ecs_progress before the backlog is dropped */
+#define ECS_FIXED_STEP_DEFAULT (1.0f/60.0f)
+#define ECS_FIXED_STEPS_MAX 8
+
+typedef struct
+ecs_system
+{
+    int phase;
+    ecs_system_function function;
+    void *user_data;
+
+    /* Zero runs every frame, otherwise the system waits wait seconds and is
+       handed elapsed, the time since it last ran */
+    float period;
+    float wait;
+    float elapsed;
+
+    /* Bit per component or resource id, writes are set in the reads as well */
+    size_t *component_reads;
+    size_t *component_writes;
+    size_t *resource_reads;
+    size_t *resource_writes;
+    int declared;
+
+    int destroyed;
+} ecs_system;
+
+/* Systems from a batch, copied out so the jobs never touch the system array */
+typedef struct
+ecs_system_job
+{
+    ecs_system_function function;
+    void *user_data;
+    float elapsed;
+} ecs_system_job;
+
+void
+ecs_system_free(ecs_system *system)
+{
+    da_free(system->component_reads);
+    da_free(system->component_writes);
+    da_free(system->resource_reads);
+    da_free(system->resource_writes);
+
+    system->component_reads = 0;
+    system->component_writes = 0;
+    system->resource_reads = 0;
+    system->resource_writes = 0;
+}
+
+/* 1 when one system writes what the other reads or writes, or either of them
+   declared nothing */
+int
+ecs_system_conflict(ecs_system *a, ecs_system *b)
+{
+    if(!a->declared || !b->declared)
+    {
+        return(1);
+    }
+
+    return(ecs_mask_intersects(a->component_writes, da_len(a->component_writes),
+                               b->component_reads, da_len(b->component_reads)) ||
+           ecs_mask_intersects(b->component_writes, da_len(b->component_writes),
+                               a->component_reads, da_len(a->component_reads)) ||
+           ecs_mask_intersects(a->resource_writes, da_len(a->resource_writes),
+                               b->resource_reads, da_len(b->resource_reads)) ||
+           ecs_mask_intersects(b->resource_writes, da_len(b->resource_writes),
+                               a->resource_reads, da_len(a->resource_reads)));
+}
+
+void
+ecs_system_job_run(size_t index, void *data)
+{
+    ecs_system_job *job;
+
+    job = &(((ecs_system_job *)data)[index]);
+    job->function(job->elapsed, job->user_data);
+}
+
+/* Prefab */
+
+typedef struct
+ecs_prefab
+{
+    /* Mask every instance starts with */
+    size_t *component_mask;
+
+    /* Default value of each component with data, parallel arrays */
+    size_t *components_ids;
+    void **components_data;
+
+    int destroyed;
+} ecs_prefab;
+
+/* World */
+
+typedef struct
+ecs_world
+{
+    size_t id;
+
+    ecs_entity_manager entity_manager;
+    ecs_component_manager component_manager;
+
+    /* Query results, reset by ecs_update */
+    ecs_arena arena;
+
+    /* Bytes of variable-size components */
+    ecs_slab slab;
+
+    /* Scratch signature used by ecs_query, rebuilt on every call */
+    ecs_query_signature query_signature;
+
+    /* Signatures compiled by ecs_query_create, query id is index + 1 */
+    ecs_query_signature *queries;
+    size_t *queries_free_slots;
+
+    /* Breadth-first order of the hierarchy, rebuilt lazily when dirty */
+    ecs_hierarchy_result hierarchy;
+    size_t hierarchy_entities_cap;
+    size_t hierarchy_parents_cap;
+    int hierarchy_dirty;
+
+    /* World-level singletons, resource id is index + 1 */
+    ecs_resource *resources;
+    size_t *resources_free_slots;
+
+    /* Event channels, channel id is index + 1 */
+    ecs_event_channel *event_channels;
+
+    /* Spatial indices, index id is index + 1 */
+    ecs_spatial_index *spatial_indices;
+
+    /* Key indices, index id is index + 1 */
+    ecs_key_index *key_indices;
+
+    /* Observers, observer id is index + 1 */
+    ecs_observer *observers;
+
+    /* Templates for ecs_entity_instantiate, prefab id is index + 1 */
+    ecs_prefab *prefabs;
+
+    /* Systems run by ecs_progress, system id is index + 1 */
+    ecs_system *systems;
+    float fixed_step;        /* Zero until set, ECS_FIXED_STEP_DEFAULT applies */
+    float fixed_accumulator; /* Time not yet consumed by fixed steps */
+
+    /* Append-only record of changes, flushed once per ecs_update */
+    FILE *journal;
+    void *journal_buffer;
+    int journal_failed;
+
+    int dead;
+    int destroyed;
+} ecs_world;
+
+size_t
+ecs_world_resource_register(ecs_world *world, size_t resource_size)
+{
+    ecs_resource resource = {0};
+    size_t resource_index;
+    size_t free_slots_length;
+
+    if(resource_size == 0)
+    {
+        return(0);
+    }
+
+    resource.size = resource_size;
+    resource.data = ecs_malloc(resource_size);
+    if(!resource.data)
+    {
+        return(0);
+    }
+
+    ecs_mem_zero(resource.data, resource_size);
+
+    free_slots_length = da_len(world->resources_free_slots);
+    if(free_slots_length > 0)
+    {
+        resource_index = world->resources_free_slots[free_slots_length - 1];
+        da_pop(world->resources_free_slots);
+        world->resources[resource_index] = resource;
+    }
+    else
+    {
+        resource_index = da_len(world->resources);
+        da_push(world->resources, resource);
+    }
+
+    return(resource_index + 1);
+}
+
+void*
+ecs_world_resource_get(ecs_world *world, size_t resource_id)
+{
+    ecs_resource *resource;
+
+    if(resource_id == 0 || resource_id > da_len(world->resources))
+    {
+        return(0);
+    }
+
+    resource = &(world->resources[resource_id - 1]);
+    if(resource->destroyed)
+    {
+        return(0);
+    }
+
+    return(resource->data);
+}
+
+void
+ecs_world_resource_unregister(ecs_world *world, size_t resource_id)
+{
+    ecs_resource *resource;
+
+    if(!ecs_world_resource_get(world, resource_id))
+    {
+        return;
+    }
+
+    resource = &(world->resources[resource_id - 1]);
+    ecs_free(resource->data);
+    resource->data = 0;
+    resource->destroyed = 1;
+    da_push(world->resources_free_slots, resource_id - 1);
+}
+
+size_t
+ecs_world_spatial_index_create(
+    ecs_world *world,
+    size_t component_id,
+    size_t offset,
+    size_t dimensions,
+    float cell_size)
+{
+    ecs_spatial_index index = {0};
+    ecs_component_list *list;
+    size_t i;
+
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!list || list->variable || dimensions < 1 || dimensions > 3 || cell_size <= 0.0f ||
+       offset + dimensions*sizeof(float) > list->unit_size)
+    {
+        return(0);
+    }
+
+    index.component_id = component_id;
+    index.offset = offset;
+    index.dimensions = dimensions;
+    index.cell_size = cell_size;
+    index.buckets = (ecs_spatial_entry **)ecs_malloc(ECS_SPATIAL_BUCKETS*sizeof(ecs_spatial_entry *));
+    if(!index.buckets)
+    {
+        return(0);
+    }
+
+    ecs_mem_zero(index.buckets, ECS_SPATIAL_BUCKETS*sizeof(ecs_spatial_entry *));
+
+    /* Index what is already there */
+    for(i = 0;
+        i < list->count;
+        ++i)
+    {
+        ecs_spatial_index_update(&index, list->entities[i], ecs_component_list_get_at(list, i));
+    }
+
+    da_push(world->spatial_indices, index);
+
+    return(da_len(world->spatial_indices));
+}
+
+ecs_spatial_index*
+ecs_world_spatial_index_get(ecs_world *world, size_t index_id)
+{
+    ecs_spatial_index *index;
+
+    if(index_id == 0 || index_id > da_len(world->spatial_indices))
+    {
+        return(0);
+    }
+
+    index = &(world->spatial_indices[index_id - 1]);
+    if(index->destroyed)
+    {
+        return(0);
+    }
+
+    return(index);
+}
+
+void
+ecs_world_spatial_index_destroy(ecs_world *world, size_t index_id)
+{
+    ecs_spatial_index *index;
+
+    index = ecs_world_spatial_index_get(world, index_id);
+    if(!index)
+    {
+        return;
+    }
+
+    ecs_spatial_index_free(index);
+    index->destroyed = 1;
+}
+
+size_t
+ecs_world_key_index_create(
+    ecs_world *world,
+    size_t component_id,
+    size_t offset,
+    size_t key_size,
+    int unique)
+{
+    ecs_key_index index = {0};
+    ecs_component_list *list;
+    size_t i;
+
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!list || list->variable || key_size < 1 || key_size > ECS_KEY_MAX_SIZE || offset + key_size > list->unit_size)
+    {
+        return(0);
+    }
+
+    index.component_id = component_id;
+    index.offset = offset;
+    index.key_size = key_size;
+    index.unique = unique;
+    index.bucket_count = ecs_key_index_buckets_for(list->count);
+    index.buckets = (ecs_key_entry **)ecs_malloc(index.bucket_count*sizeof(ecs_key_entry *));
+    if(!index.buckets)
+    {
+        return(0);
+    }
+
+    ecs_mem_zero(index.buckets, index.bucket_count*sizeof(ecs_key_entry *));
+
+    /* Index what is already there, on a unique index the first row holding
+       a key keeps it */
+    for(i = 0;
+        i < list->count;
+        ++i)
+    {
+        ecs_key_index_update(&index, list->entities[i], ecs_component_list_get_at(list, i));
+    }
+
+    da_push(world->key_indices, index);
+
+    return(da_len(world->key_indices));
+}
+
+ecs_key_index*
+ecs_world_key_index_get(ecs_world *world, size_t index_id)
+{
+    ecs_key_index *index;
+
+    if(index_id == 0 || index_id > da_len(world->key_indices))
+    {
+        return(0);
+    }
+
+    index = &(world->key_indices[index_id - 1]);
+    if(index->destroyed)
+    {
+        return(0);
+    }
+
+    return(index);
+}
+
+void
+ecs_world_key_index_destroy(ecs_world *world, size_t index_id)
+{
+    ecs_key_index *index;
+
+    index = ecs_world_key_index_get(world, index_id);
+    if(!index)
+    {
+        return;
+    }
+
+    ecs_key_index_free(index);
+    index->destroyed = 1;
+}
+
+/* Journal */
+
+#ifndef ECS_JOURNAL_BUFFER
+#define ECS_JOURNAL_BUFFER (1 << 20)
+#endif
+
+#define ECS_JOURNAL_IDS     1 /* entity_id carries the id counter */
+#define ECS_JOURNAL_CREATE  2
+#define ECS_JOURNAL_DESTROY 3
+#define ECS_JOURNAL_ATTACH  4
+#define ECS_JOURNAL_DETACH  5
+#define ECS_JOURNAL_WRITE   6 /* Followed by size bytes of component data */
+
+/* Records use the native layout, a journal is replayed by the same build */
+typedef struct
+ecs_journal_record
+{
+    size_t type;
+    size_t entity_id;
+    size_t component_id;
+    size_t size;
+} ecs_journal_record;
+
+int
+ecs_journal_record_write(
+    FILE *file,
+    size_t type,
+    size_t entity_id,
+    size_t component_id,
+    void *data,
+    size_t size)
+{
+    ecs_journal_record record;
+
+    record.type = type;
+    record.entity_id = entity_id;
+    record.component_id = component_id;
+    record.size = size;
+
+    if(fwrite(&record, sizeof(record), 1, file) != 1)
+    {
+        return(0);
+    }
+
+    if(size && fwrite(data, size, 1, file) != 1)
+    {
+        return(0);
+    }
+
+    return(1);
+}
+
+void
+ecs_world_journal(
+    ecs_world *world,
+    size_t type,
+    size_t entity_id,
+    size_t component_id,
+    void *data,
+    size_t size)
+{
+    if(!world->journal)
+    {
+        return;
+    }
+
+    if(!ecs_journal_record_write(world->journal, type, entity_id, component_id, data, size))
+    {
+        world->journal_failed = 1;
+    }
+}
+
+/* Everything needed to recreate one entity: its id, components and their data */
+int
+ecs_world_journal_entity(ecs_world *world, FILE *file, ecs_entity *entity)
+{
+    size_t bit;
+
+    if(!ecs_journal_record_write(file, ECS_JOURNAL_CREATE, entity->id, 0, 0, 0))
+    {
+        return(0);
+    }
+
+    for(bit = ecs_mask_next(entity->component_mask, da_len(entity->component_mask), 0);
+        bit != ECS_MASK_END;
+        bit = ecs_mask_next(entity->component_mask, da_len(entity->component_mask), bit + 1))
+    {
+        ecs_component_list *list;
+        void *data;
+        size_t size;
+
+        if(!ecs_journal_record_write(file, ECS_JOURNAL_ATTACH, entity->id, bit + 1, 0, 0))
+        {
+            return(0);
+        }
+
+        list = ecs_component_manager_get_list(&world->component_manager, bit + 1);
+        data = list ? ecs_component_list_row_bytes(list, entity->id, &size) : 0;
+        if(data && !ecs_journal_record_write(file, ECS_JOURNAL_WRITE, entity->id, bit + 1, data, size))
+        {
+            return(0);
+        }
+    }
+
+    return(1);
+}
+
+/* 0 if a record could not be written since the journal was opened */
+int
+ecs_world_journal_flush(ecs_world *world)
+{
+    if(!world->journal)
+    {
+        return(0);
+    }
+
+    if(fflush(world->journal) != 0)
+    {
+        world->journal_failed = 1;
+    }
+
+    return(!world->journal_failed);
+}
+
+int
+ecs_world_journal_close(ecs_world *world)
+{
+    int ok;
+
+    ok = 1;
+    if(world->journal)
+    {
+        ok = ecs_world_journal_flush(world);
+        if(fclose(world->journal) != 0)
+        {
+            ok = 0;
+        }
+    }
+
+    ecs_free(world->journal_buffer);
+
+    world->journal = 0;
+    world->journal_buffer = 0;
+    world->journal_failed = 0;
+
+    return(ok);
+}
+
+/* Starts a new journal at path, replacing any file there */
+int
+ecs_world_journal_open(ecs_world *world, const char *path)
+{
+    ecs_world_journal_close(world);
+
+    world->journal = fopen(path, "wb");
+    if(!world->journal)
+    {
+        return(0);
+    }
+
+    /* Records are small, a large buffer turns them into few big writes */
+    world->journal_buffer = ecs_malloc(ECS_JOURNAL_BUFFER);
+    if(world->journal_buffer)
+    {
+        setvbuf(world->journal, (char *)world->journal_buffer, _IOFBF, ECS_JOURNAL_BUFFER);
+    }
+
+    return(1);
+}
+
+/* Event channel */
+
+size_t
+ecs_world_event_channel_register(ecs_world *world, size_t event_size, size_t capacity)
+{
+    ecs_event_channel channel = {0};
+
+    if(event_size == 0)
+    {
+        return(0);
+    }
+
+    channel.event_size = event_size;
+    if(capacity)
+    {
+        channel.data = (unsigned char *)ecs_malloc(capacity*event_size);
+        if(!channel.data)
+        {
+            return(0);
+        }
+
+        channel.cap = capacity;
+    }
+
+    da_push(world->event_channels, channel);
+
+    return(da_len(world->event_channels));
+}
+
+ecs_event_channel*
+ecs_world_event_channel_get(ecs_world *world, size_t channel_id)
+{
+    ecs_event_channel *channel;
+
+    if(channel_id == 0 || channel_id > da_len(world->event_channels))
+    {
+        return(0);
+    }
+
+    channel = &(world->event_channels[channel_id - 1]);
+    if(channel->destroyed)
+    {
+        return(0);
+    }
+
+    return(channel);
+}
+
+void
+ecs_world_event_channel_unregister(ecs_world *world, size_t channel_id)
+{
+    ecs_event_channel *channel;
+
+    channel = ecs_world_event_channel_get(world, channel_id);
+    if(!channel)
+    {
+        return;
+    }
+
+    ecs_free(channel->data);
+    channel->data = 0;
+    channel->cap = 0;
+    channel->count = 0;
+    channel->committed = 0;
+    channel->destroyed = 1;
+}
+
+/* Lock-free, count contiguous slots or 0 once the channel is full */
+void*
+ecs_event_channel_reserve(ecs_event_channel *channel, size_t count)
+{
+    size_t first;
+
+    if(count == 0)
+    {
+        return(0);
+    }
+
+    first = ecs_atomic_add(&channel->count, count);
+    if(first + count > channel->cap)
+    {
+        return(0);
+    }
+
+    ecs_atomic_add(&channel->committed, count);
+
+    return(channel->data + first*channel->event_size);
+}
+
+/* Only slots of reservations that fit, a failed one near the end leaves a gap
+   that is never read */
+void*
+ecs_event_channel_read(ecs_event_channel *channel, size_t *count)
+{
+    *count = channel->committed;
+
+    return(*count ? channel->data : 0);
+}
+
+/* Called by ecs_update, a channel that overflowed grows to the largest frame seen */
+void
+ecs_event_channel_clear(ecs_event_channel *channel)
+{
+    size_t cap;
+    void *data;
+
+    if(channel->count > channel->cap)
+    {
+        cap = (channel->cap*2 > channel->count) ? channel->cap*2 : channel->count;
+        data = ecs_malloc(cap*channel->event_size);
+        if(data)
+        {
+            ecs_free(channel->data);
+            channel->data = (unsigned char *)data;
+            channel->cap = cap;
+        }
+    }
+
+    channel->count = 0;
+    channel->committed = 0;
+}
+
+/* Change tracking */
+
+size_t
+ecs_world_observer_register(
+    ecs_world *world,
+    size_t component_id,
+    int event,
+    ecs_observer_function callback,
+    void *user_data)
+{
+    ecs_observer observer = {0};
+
+    if(!callback || event < ECS_EVENT_ADD || event > ECS_EVENT_SET)
+    {
+        return(0);
+    }
+
+    observer.component_id = component_id;
+    observer.event = event;
+    observer.callback = callback;
+    observer.user_data = user_data;
+    da_push(world->observers, observer);
+
+    return(da_len(world->observers));
+}
+
+void
+ecs_world_observer_unregister(ecs_world *world, size_t observer_id)
+{
+    ecs_observer *observer;
+
+    if(observer_id == 0 || observer_id > da_len(world->observers))
+    {
+        return;
+    }
+
+    observer = &(world->observers[observer_id - 1]);
+    ecs_free(observer->pending);
+    observer->pending = 0;
+    observer->pending_count = 0;
+    observer->pending_cap = 0;
+    observer->destroyed = 1;
+}
+
+/* Hands every observer its queued entities in one call */
+void
+ecs_world_observers_flush(ecs_world *world)
+{
+    size_t i;
+
+    for(i = 0;
+        i < da_len(world->observers);
+        ++i)
+    {
+        ecs_observer *observer;
+        size_t *pending, pending_count, pending_cap;
+
+        observer = &(world->observers[i]);
+        if(observer->destroyed || !observer->pending_count)
+        {
+            continue;
+        }
+
+        /* Detach the batch first, the callback may queue more changes */
+        pending = observer->pending;
+        pending_count = observer->pending_count;
+        pending_cap = observer->pending_cap;
+        observer->pending = 0;
+        observer->pending_count = 0;
+        observer->pending_cap = 0;
+
+        observer->callback(observer->component_id, observer->event, pending, pending_count, observer->user_data);
+
+        /* The callback can register observers and move the array */
+        observer = &(world->observers[i]);
+        if(!observer->pending && !observer->destroyed)
+        {
+            observer->pending = pending;
+            observer->pending_cap = pending_cap;
+        }
+        else
+        {
+            ecs_free(pending);
+        }
+    }
+}
+
+/* Returns 0 when a unique key index rejected the component's key */
+int
+ecs_world_key_indices_changed(
+    ecs_world *world,
+    size_t entity_id,
+    size_t component_id,
+    int event)
+{
+    size_t i;
+    int ok;
+
+    ok = 1;
+    for(i = 0;
+        i < da_len(world->key_indices);
+        ++i)
+    {
+        ecs_key_index *index;
+
+        index = &(world->key_indices[i]);
+        if(index->destroyed || index->component_id != component_id)
+        {
+            continue;
+        }
+
+        if(event == ECS_EVENT_REMOVE)
+        {
+            ecs_key_index_remove(index, entity_id);
+        }
+        else if(!ecs_key_index_update(index, entity_id,
+                    ecs_component_manager_get(&world->component_manager, entity_id, component_id)))
+        {
+            ok = 0;
+        }
+    }
+
+    return(ok);
+}
+
+/* Called for every structural change and tracked write, before a removed
+   component's data goes away and after an added one is zeroed. */
+void
+ecs_world_component_changed(
+    ecs_world *world,
+    size_t entity_id,
+    size_t component_id,
+    int event)
+{
+    size_t i;
+
+    for(i = 0;
+        i < da_len(world->observers);
+        ++i)
+    {
+        ecs_observer *observer;
+
+        observer = &(world->observers[i]);
+        if(observer->destroyed || observer->component_id != component_id || observer->event != event)
+        {
+            continue;
+        }
+
+        if(ecs_mem_reserve((void **)&observer->pending, &observer->pending_cap,
+                           observer->pending_count + 1, sizeof(size_t)))
+        {
+            observer->pending[observer->pending_count++] = entity_id;
+        }
+    }
+
+    for(i = 0;
+        i < da_len(world->spatial_indices);
+        ++i)
+    {
+        ecs_spatial_index *index;
+
+        index = &(world->spatial_indices[i]);
+        if(index->destroyed || index->component_id != component_id)
+        {
+            continue;
+        }
+
+        if(event == ECS_EVENT_REMOVE)
+        {
+            ecs_spatial_index_remove(index, entity_id);
+        }
+        else
+        {
+            ecs_spatial_index_update(index, entity_id,
+                ecs_component_manager_get(&world->component_manager, entity_id, component_id));
+        }
+    }
+
+    /* Writes were checked against the key indices before being reported */
+    if(event != ECS_EVENT_SET)
+    {
+        ecs_world_key_indices_changed(world, entity_id, component_id, event);
+    }
+}
+
+void
+ecs_world_entity_components_removed(ecs_world *world, ecs_entity *entity)
+{
+    size_t bit;
+
+    for(bit = ecs_mask_next(entity->component_mask, da_len(entity->component_mask), 0);
+        bit != ECS_MASK_END;
+        bit = ecs_mask_next(entity->component_mask, da_len(entity->component_mask), bit + 1))
+    {
+        ecs_world_component_changed(world, entity->id, bit + 1, ECS_EVENT_REMOVE);
+    }
+}
+
+/* Hierarchy */
+
+void
+ecs_world_hierarchy_child_remove(ecs_entity *parent, size_t child_id)
+{
+    size_t i, children_count;
+
+    children_count = da_len(parent->children);
+    for(i = 0;
+        i < children_count;
+        ++i)
+    {
+        if(parent->children[i] == child_id)
+        {
+            /* Keep siblings in order, traversal order should not depend on removals */
+            for(;
+                i + 1 < children_count;
+                ++i)
+            {
+                parent->children[i] = parent->children[i + 1];
+            }
+
+            da_pop(parent->children);
+            break;
+        }
+    }
+}
+
+void
+ecs_world_entity_parent_set(
+    ecs_world *world,
+    size_t entity_id,
+    size_t parent_id)
+{
+    ecs_entity *entity, *parent, *ancestor, *old_parent;
+
+    /* Dead entities are on their way out, they neither get nor become parents */
+    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
+    if(!entity || entity->dead || entity->parent == parent_id)
+    {
+        return;
+    }
+
+    parent = 0;
+    if(parent_id)
+    {
+        parent = ecs_entity_manager_get(&world->entity_manager, parent_id);
+        if(!parent || parent->dead)
+        {
+            return;
+        }
+
+        /* Refuse to create a cycle */
+        ancestor = parent;
+        while(ancestor)
+        {
+            if(ancestor->id == entity_id)
+            {
+                return;
+            }
+
+            ancestor = ancestor->parent ? ecs_entity_manager_get(&world->entity_manager, ancestor->parent) : 0;
+        }
+    }
+
+    if(entity->parent)
+    {
+        old_parent = ecs_entity_manager_get(&world->entity_manager, entity->parent);
+        if(old_parent)
+        {
+            ecs_world_hierarchy_child_remove(old_parent, entity_id);
+        }
+    }
+
+    entity->parent = parent_id;
+    if(parent)
+    {
+        da_push(parent->children, entity_id);
+    }
+
+    world->hierarchy_dirty = 1;
+}
+
+void
+ecs_world_hierarchy_unlink(ecs_world *world, ecs_entity *entity)
+{
+    size_t i;
+    ecs_entity *relative;
+
+    if(!entity->parent && !entity->children)
+    {
+        return;
+    }
+
+    if(entity->parent)
+    {
+        relative = ecs_entity_manager_get(&world->entity_manager, entity->parent);
+        if(relative)
+        {
+            ecs_world_hierarchy_child_remove(relative, entity->id);
+        }
+
+        entity->parent = 0;
+    }
+
+    /* Children that are not being destroyed with their parent become roots */
+    for(i = 0;
+        i < da_len(entity->children);
+        ++i)
+    {
+        relative = ecs_entity_manager_get(&world->entity_manager, entity->children[i]);
+        if(relative)
+        {
+            relative->parent = 0;
+        }
+    }
+
+    da_free(entity->children);
+    entity->children = 0;
+
+    world->hierarchy_dirty = 1;
+}
+
+void
+ecs_world_entity_destroy_tree(ecs_world *world, size_t entity_id)
+{
+    ecs_hierarchy_result *hierarchy;
+    ecs_entity *entity;
+    size_t i, head, tail;
+
+    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
+    if(!entity)
+    {
+        return;
+    }
+
+    /* Reuse the traversal buffer as the breadth-first queue, it is rebuilt on next use */
+    hierarchy = &world->hierarchy;
+    if(!ecs_mem_reserve((void **)&hierarchy->entities, &world->hierarchy_entities_cap, 1, sizeof(size_t)))
+    {
+        return;
+    }
+
+    hierarchy->entities[0] = entity_id;
+    hierarchy->count = 0;
+    world->hierarchy_dirty = 1;
+
+    head = 0;
+    tail = 1;
+    while(head < tail)
+    {
+        size_t children_count;
+
+        entity = ecs_entity_manager_get(&world->entity_manager, hierarchy->entities[head++]);
+        if(!entity)
+        {
+            continue;
+        }
+
+        entity->dead = 1;
+
+        children_count = da_len(entity->children);
+        if(!ecs_mem_reserve((void **)&hierarchy->entities, &world->hierarchy_entities_cap, tail + children_count, sizeof(size_t)))
+        {
+            return;
+        }
+
+        for(i = 0;
+            i < children_count;
+            ++i)
+        {
+            hierarchy->entities[tail++] = entity->children[i];
+        }
+    }
+}
+
+ecs_hierarchy_result*
+ecs_world_hierarchy(ecs_world *world)
+{
+    ecs_hierarchy_result *hierarchy;
+    size_t entity_index, head, tail;
+
+    hierarchy = &world->hierarchy;
+    if(!world->hierarchy_dirty)
+    {
+        return(hierarchy);
+    }
+
+    tail = 0;
+
+    /* Roots first: live entities with children and without a live parent.
+       Dead entities are left out with their links until the next sync. */
+    for(entity_index = 0;
+        entity_index < world->entity_manager.cap;
+        ++entity_index)
+    {
+        ecs_entity *entity, *parent;
+
+        entity = &(world->entity_manager.entities[entity_index]);
+        if(entity->destroyed || entity->dead || !da_len(entity->children))
+        {
+            continue;
+        }
+
+        parent = entity->parent ? ecs_entity_manager_get(&world->entity_manager, entity->parent) : 0;
+        if(parent && !parent->dead)
+        {
+            continue;
+        }
+
+        if(!ecs_mem_reserve((void **)&hierarchy->entities, &world->hierarchy_entities_cap, tail + 1, sizeof(size_t)) ||
+           !ecs_mem_reserve((void **)&hierarchy->parents, &world->hierarchy_parents_cap, tail + 1, sizeof(size_t)))
+        {
+            hierarchy->count = 0;
+            return(hierarchy);
+        }
+
+        hierarchy->entities[tail] = entity->id;
+        hierarchy->parents[tail] = ECS_HIERARCHY_ROOT;
+        tail += 1;
+    }
+
+    /* Then every level in turn, the output doubles as the queue */
+    head = 0;
+    while(head < tail)
+    {
+        ecs_entity *entity;
+        size_t i, children_count;
+
+        entity = ecs_entity_manager_get(&world->entity_manager, hierarchy->entities[head]);
+        children_count = entity ? da_len(entity->children) : 0;
+
+        if(!ecs_mem_reserve((void **)&hierarchy->entities, &world->hierarchy_entities_cap, tail + children_count, sizeof(size_t)) ||
+           !ecs_mem_reserve((void **)&hierarchy->parents, &world->hierarchy_parents_cap, tail + children_count, sizeof(size_t)))
+        {
+            hierarchy->count = 0;
+            return(hierarchy);
+        }
+
+        for(i = 0;
+            i < children_count;
+            ++i)
+        {
+            ecs_entity *child;
+
+            child = ecs_entity_manager_get(&world->entity_manager, entity->children[i]);
+            if(!child || child->dead)
+            {
+                continue;
+            }
+
+            hierarchy->entities[tail] = entity->children[i];
+            hierarchy->parents[tail] = head;
+            tail += 1;
+        }
+
+        head += 1;
+    }
+
+    hierarchy->count = tail;
+    world->hierarchy_dirty = 0;
+
+    return(hierarchy);
+}
+
+size_t
+ecs_world_entity_create(ecs_world *world)
+{
+    size_t entity_id;
+
+    entity_id = ecs_entity_manager_create(&world->entity_manager);
+    ecs_world_journal(world, ECS_JOURNAL_CREATE, entity_id, 0, 0, 0);
+
+    return(entity_id);
+}
+
+void
+ecs_world_entities_reserved_flush(ecs_world *world)
+{
+    size_t i;
+
+    if(world->journal)
+    {
+        for(i = 0;
+            i < world->entity_manager.reserved_count && i < world->entity_manager.reserved_cap;
+            ++i)
+        {
+            ecs_world_journal(world, ECS_JOURNAL_CREATE, world->entity_manager.reserved[i], 0, 0, 0);
+        }
+    }
+
+    ecs_entity_manager_reserved_flush(&world->entity_manager);
+}
+
+/* Variable-size rows hand their bytes back to the slab at the next ecs_update */
+void
+ecs_world_blob_release(ecs_world *world, ecs_component_list *list, size_t entity_id)
+{
+    ecs_blob *blob;
+
+    if(!list || !list->variable)
+    {
+        return;
+    }
+
+    blob = (ecs_blob *)ecs_component_list_get(list, entity_id);
+    if(blob)
+    {
+        ecs_slab_release(&world->slab, *blob);
+        blob->data = 0;
+        blob->size = 0;
+    }
+}
+
+void
+ecs_world_entity_blobs_release(ecs_world *world, ecs_entity *entity)
+{
+    size_t bit;
+
+    for(bit = ecs_mask_next(entity->component_mask, da_len(entity->component_mask), 0);
+        bit != ECS_MASK_END;
+        bit = ecs_mask_next(entity->component_mask, da_len(entity->component_mask), bit + 1))
+    {
+        ecs_world_blob_release(world, ecs_component_manager_get_list(&world->component_manager, bit + 1), entity->id);
+    }
+}
+
+void
+ecs_world_entity_destroy(ecs_world *world, size_t entity_id)
+{
+    ecs_entity *entity;
+
+    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
+    if(entity)
+    {
+        ecs_world_journal(world, ECS_JOURNAL_DESTROY, entity_id, 0, 0, 0);
+        ecs_world_entity_components_removed(world, entity);
+        ecs_world_entity_blobs_release(world, entity);
+        ecs_world_hierarchy_unlink(world, entity);
+    }
+
+    ecs_entity_manager_destroy(&world->entity_manager, entity_id);
+    ecs_component_manager_entity_destroyed(&world->component_manager, entity_id);
+}
+
+size_t
+ecs_world_component_register(ecs_world *world, size_t component_size)
+{
+    size_t component_id;
+
+    component_id = ecs_component_manager_register(&world->component_manager, component_size);
+
+    return(component_id);
+}
+
+size_t
+ecs_world_component_register_variable(ecs_world *world)
+{
+    size_t component_id;
+    ecs_component_list *list;
+
+    component_id = ecs_component_manager_register(&world->component_manager, sizeof(ecs_blob));
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(list)
+    {
+        list->variable = 1;
+    }
+
+    return(component_id);
+}
+
+void
+ecs_world_component_unregister(ecs_world *world, size_t component_id)
+{
+    ecs_component_list *list;
+    size_t i;
+
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(list && list->variable)
+    {
+        for(i = 0;
+            i < list->count;
+            ++i)
+        {
+            ecs_slab_release(&world->slab, ((ecs_blob *)list->data)[i]);
+        }
+    }
+
+    ecs_component_manager_unregister(&world->component_manager, component_id);
+}
+
+/* A row is skipped when its component or its entity is disabled */
+void
+ecs_world_entity_row_refresh(ecs_world *world, ecs_entity *entity, size_t component_id)
+{
+    ecs_component_list *list;
+    size_t *index;
+
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!list || list->unit_size == 0)
+    {
+        /* Tags only have the bit in the entity mask */
+        return;
+    }
+
+    index = ecs_map_get(&list->entity_to_index, entity->id);
+    if(index)
+    {
+        ecs_component_list_row_disable(list, *index,
+            entity->disabled || ecs_mask_test(entity->disabled_mask, da_len(entity->disabled_mask), component_id - 1));
+    }
+}
+
+/* Nothing moves, the entity keeps its components and their values */
+void
+ecs_world_entity_enable(ecs_world *world, size_t entity_id, int enable)
+{
+    ecs_entity_manager *entity_manager;
+    ecs_entity *entity;
+    size_t slot, bit;
+
+    entity_manager = &world->entity_manager;
+    entity = ecs_entity_manager_get(entity_manager, entity_id);
+    if(!entity || entity->dead || entity->disabled == !enable)
+    {
+        return;
+    }
+
+    entity->disabled = !enable;
+
+    slot = (size_t)(entity - entity_manager->entities);
+    if(entity->disabled)
+    {
+        entity_manager->disabled = ecs_mask_grow(entity_manager->disabled, slot);
+        ecs_mask_set(entity_manager->disabled, slot);
+    }
+    else
+    {
+        ecs_mask_clear(entity_manager->disabled, da_len(entity_manager->disabled), slot);
+    }
+
+    for(bit = ecs_mask_next(entity->component_mask, da_len(entity->component_mask), 0);
+        bit != ECS_MASK_END;
+        bit = ecs_mask_next(entity->component_mask, da_len(entity->component_mask), bit + 1))
+    {
+        ecs_world_entity_row_refresh(world, entity, bit + 1);
+    }
+}
+
+int
+ecs_world_entity_enabled(ecs_world *world, size_t entity_id)
+{
+    ecs_entity *entity;
+
+    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
+
+    return(entity && !entity->dead && !entity->disabled);
+}
+
+void
+ecs_world_entity_component_enable(
+    ecs_world *world,
+    size_t entity_id,
+    size_t component_id,
+    int enable)
+{
+    ecs_entity *entity;
+
+    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
+    if(!entity || entity->dead || component_id == 0 ||
+       !ecs_mask_test(entity->component_mask, da_len(entity->component_mask), component_id - 1))
+    {
+        return;
+    }
+
+    if(enable)
+    {
+        ecs_mask_clear(entity->disabled_mask, da_len(entity->disabled_mask), component_id - 1);
+    }
+    else
+    {
+        entity->disabled_mask = ecs_mask_grow(entity->disabled_mask, component_id - 1);
+        ecs_mask_set(entity->disabled_mask, component_id - 1);
+    }
+
+    ecs_world_entity_row_refresh(world, entity, component_id);
+}
+
+/* 0 when the entity or the component is disabled, or the component is not attached */
+int
+ecs_world_entity_component_enabled(
+    ecs_world *world,
+    size_t entity_id,
+    size_t component_id)
+{
+    ecs_entity *entity;
+
+    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
+    if(!entity || entity->dead || entity->disabled || component_id == 0)
+    {
+        return(0);
+    }
+
+    return(ecs_mask_test(entity->component_mask, da_len(entity->component_mask), component_id - 1) &&
+           !ecs_mask_test(entity->disabled_mask, da_len(entity->disabled_mask), component_id - 1));
+}
+
+size_t*
+ecs_world_component_disabled(ecs_world *world, size_t component_id, size_t *count)
+{
+    ecs_component_list *list;
+
+    *count = 0;
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!list || !list->disabled_count)
+    {
+        return(0);
+    }
+
+    *count = da_len(list->disabled);
+
+    return(list->disabled);
+}
+
+/* Lists are resolved once, each row costs an entity lookup and a row lookup
+   per extra component */
+size_t*
+ecs_world_component_rows(
+    ecs_world *world,
+    const size_t *components_ids,
+    size_t num_components,
+    size_t *count)
+{
+    ecs_component_list **lists;
+    ecs_component_list *first;
+    ecs_entity *entity;
+    size_t *rows, *row, *index;
+    size_t i, k, words_count;
+
+    *count = 0;
+    if(num_components == 0)
+    {
+        return(0);
+    }
+
+    first = ecs_component_manager_get_list(&world->component_manager, components_ids[0]);
+    if(!first || first->unit_size == 0 || first->count == 0)
+    {
+        return(0);
+    }
+
+    lists = (ecs_component_list **)ecs_arena_push(&world->arena, num_components*sizeof(ecs_component_list *));
+    rows = (size_t *)ecs_arena_push(&world->arena, first->count*num_components*sizeof(size_t));
+    if(!lists || !rows)
+    {
+        return(0);
+    }
+
+    for(k = 0;
+        k < num_components;
+        ++k)
+    {
+        lists[k] = ecs_component_manager_get_list(&world->component_manager, components_ids[k]);
+        if(!lists[k])
+        {
+            return(0);
+        }
+    }
+
+    words_count = da_len(first->disabled);
+    for(i = 0;
+        i < first->count;
+        ++i)
+    {
+        if(ecs_mask_word_full(first->disabled, words_count, i))
+        {
+            i += ECS_MASK_BITS - 1;
+            continue;
+        }
+
+        if(ecs_mask_test(first->disabled, words_count, i))
+        {
+            continue;
+        }
+
+        entity = ecs_entity_manager_get(&world->entity_manager, first->entities[i]);
+        if(!entity || entity->dead)
+        {
+            continue;
+        }
+
+        row = rows + *count*num_components;
+        row[0] = i;
+        for(k = 1;
+            k < num_components;
+            ++k)
+        {
+            if(!ecs_mask_test(entity->component_mask, da_len(entity->component_mask), components_ids[k] - 1) ||
+               ecs_mask_test(entity->disabled_mask, da_len(entity->disabled_mask), components_ids[k] - 1))
+            {
+                break;
+            }
+
+            row[k] = 0;
+            if(lists[k]->unit_size)
+            {
+                index = ecs_map_get(&lists[k]->entity_to_index, entity->id);
+                if(!index)
+                {
+                    break;
+                }
+
+                row[k] = *index;
+            }
+        }
+
+        if(k == num_components)
+        {
+            ++*count;
+        }
+    }
+
+    return(rows);
+}
+
+void
+ecs_world_entity_component_attach(
+    ecs_world *world,
+    size_t entity_id,
+    size_t component_id)
+{
+    ecs_entity *entity;
+
+    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
+    if(!entity || component_id == 0)
+    {
+        return;
+    }
+
+    ecs_component_manager_add(&world->component_manager, entity_id, component_id);
+
+    if(ecs_mask_test(entity->component_mask, da_len(entity->component_mask), component_id - 1))
+    {
+        return;
+    }
+
+    entity->component_mask = ecs_mask_grow(entity->component_mask, component_id - 1);
+    ecs_mask_set(entity->component_mask, component_id - 1);
+    if(entity->disabled)
+    {
+        ecs_world_entity_row_refresh(world, entity, component_id);
+    }
+
+    ecs_world_journal(world, ECS_JOURNAL_ATTACH, entity_id, component_id, 0, 0);
+    ecs_world_component_changed(world, entity_id, component_id, ECS_EVENT_ADD);
+}
+
+void
+ecs_world_entity_component_detach(
+    ecs_world *world,
+    size_t entity_id,
+    size_t component_id)
+{
+    ecs_entity *entity;
+
+    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
+    if(!entity || component_id == 0)
+    {
+        return;
+    }
+
+    if(ecs_mask_test(entity->component_mask, da_len(entity->component_mask), component_id - 1))
+    {
+        ecs_world_journal(world, ECS_JOURNAL_DETACH, entity_id, component_id, 0, 0);
+        ecs_world_component_changed(world, entity_id, component_id, ECS_EVENT_REMOVE);
+        ecs_world_blob_release(world, ecs_component_manager_get_list(&world->component_manager, component_id), entity_id);
+    }
+
+    ecs_component_manager_remove(&world->component_manager, entity_id, component_id);
+
+    /* Attached again, the component starts enabled */
+    ecs_mask_clear(entity->component_mask, da_len(entity->component_mask), component_id - 1);
+    ecs_mask_clear(entity->disabled_mask, da_len(entity->disabled_mask), component_id - 1);
+}
+
+int
+ecs_world_entity_component_has(
+    ecs_world *world,
+    size_t entity_id,
+    size_t component_id)
+{
+    ecs_entity *entity;
+
+    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
+    if(!entity || entity->dead || component_id == 0)
+    {
+        return(0);
+    }
+
+    return(ecs_mask_test(entity->component_mask, da_len(entity->component_mask), component_id - 1));
+}
+
+void*
+ecs_world_entity_component_get(
+    ecs_world *world,
+    size_t entity_id,
+    size_t component_id)
+{
+    if(!ecs_world_entity_component_has(world, entity_id, component_id))
+    {
+        return(0);
+    }
+
+    return(ecs_component_manager_get(&world->component_manager, entity_id, component_id));
+}
+
+/* A write a unique key index rejects is undone and not reported */
+int
+ecs_world_entity_component_modified(
+    ecs_world *world,
+    size_t entity_id,
+    size_t component_id)
+{
+    if(!ecs_world_entity_component_has(world, entity_id, component_id))
+    {
+        return(0);
+    }
+
+    if(!ecs_world_key_indices_changed(world, entity_id, component_id, ECS_EVENT_SET))
+    {
+        return(0);
+    }
+
+    if(world->journal)
+    {
+        ecs_component_list *list;
+        void *data;
+        size_t size;
+
+        list = ecs_component_manager_get_list(&world->component_manager, component_id);
+        data = list ? ecs_component_list_row_bytes(list, entity_id, &size) : 0;
+        if(data)
+        {
+            ecs_world_journal(world, ECS_JOURNAL_WRITE, entity_id, component_id, data, size);
+        }
+    }
+
+    ecs_world_component_changed(world, entity_id, component_id, ECS_EVENT_SET);
+
+    return(1);
+}
+
+/* Keeps the bytes that fit and zeroes the rest, the bytes may move */
+void*
+ecs_world_entity_component_resize(
+    ecs_world *world,
+    size_t entity_id,
+    size_t component_id,
+    size_t size)
+{
+    ecs_component_list *list;
+    ecs_blob *blob;
+    void *data;
+    size_t kept;
+
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!list || !list->variable)
+    {
+        return(0);
+    }
+
+    blob = (ecs_blob *)ecs_component_list_get(list, entity_id);
+    if(!blob)
+    {
+        return(0);
+    }
+
+    kept = (size < blob->size) ? size : blob->size;
+
+    /* Same size class, the block already has room */
+    if(blob->data && size && ecs_slab_class(size) < ECS_SLAB_CLASSES &&
+       ecs_slab_class(size) == ecs_slab_class(blob->size))
+    {
+        ecs_mem_zero((unsigned char *)blob->data + kept, size - kept);
+        blob->size = size;
+        return(blob->data);
+    }
+
+    data = ecs_slab_alloc(&world->slab, size);
+    if(size && !data)
+    {
+        return(0);
+    }
+
+    ecs_mem_copy(blob->data, data, kept);
+    ecs_mem_zero((unsigned char *)data + kept, size - kept);
+
+    /* Readers holding the old pointer keep it until ecs_update */
+    ecs_slab_release(&world->slab, *blob);
+
+    blob->data = data;
+    blob->size = size;
+
+    return(data);
+}
+
+/* Pipeline */
+
+/* The deferred work of ecs_update that systems of the next phase need done */
+void
+ecs_world_sync(ecs_world *world)
+{
+    size_t entity_index;
+
+    ecs_world_entities_reserved_flush(world);
+
+    for(entity_index = 0;
+        entity_index < world->entity_manager.cap;
+        ++entity_index)
+    {
+        ecs_entity *entity;
+
+        entity = &(world->entity_manager.entities[entity_index]);
+        if(entity->dead && !entity->destroyed)
+        {
+            ecs_world_entity_destroy(world, entity->id);
+        }
+    }
+
+    ecs_world_observers_flush(world);
+}
+
+size_t
+ecs_world_system_register(
+    ecs_world *world,
+    int phase,
+    ecs_system_function function,
+    float frequency,
+    void *user_data)
+{
+    ecs_system system = {0};
+    float spread;
+
+    /* The fixed step is the only rate of the fixed phase */
+    if(!function || phase < ECS_PHASE_PRE_UPDATE || phase > ECS_PHASE_POST_UPDATE || !(frequency >= 0.0f) ||
+       (phase == ECS_PHASE_FIXED && frequency != 0.0f))
+    {
+        return(0);
+    }
+
+    system.phase = phase;
+    system.function = function;
+    system.user_data = user_data;
+
+    /* Successive systems start at golden-ratio fractions of their period,
+       so systems of the same rate fall on different frames */
+    if(frequency > 0.0f)
+    {
+        spread = (float)da_len(world->systems)*0.6180339887f;
+        spread -= (float)(size_t)spread;
+        system.period = 1.0f/frequency;
+        system.wait = system.period*spread;
+    }
+
+    da_push(world->systems, system);
+
+    return(da_len(world->systems));
+}
+
+void
+ecs_world_system_unregister(ecs_world *world, size_t system_id)
+{
+    if(system_id == 0 || system_id > da_len(world->systems))
+    {
+        return;
+    }
+
+    ecs_system_free(&(world->systems[system_id - 1]));
+    world->systems[system_id - 1].destroyed = 1;
+}
+
+ecs_system*
+ecs_world_system_get(ecs_world *world, size_t system_id)
+{
+    if(system_id == 0 || system_id > da_len(world->systems) || world->systems[system_id - 1].destroyed)
+    {
+        return(0);
+    }
+
+    return(&(world->systems[system_id - 1]));
+}
+
+int
+ecs_world_system_component_access(
+    ecs_world *world,
+    size_t system_id,
+    size_t component_id,
+    int access)
+{
+    ecs_system *system;
+
+    system = ecs_world_system_get(world, system_id);
+    if(!system || !(access & (ECS_READ | ECS_WRITE)) ||
+       !ecs_component_manager_get_list(&world->component_manager, component_id))
+    {
+        return(0);
+    }
+
+    system->component_reads = ecs_mask_grow(system->component_reads, component_id - 1);
+    ecs_mask_set(system->component_reads, component_id - 1);
+    if(access & ECS_WRITE)
+    {
+        system->component_writes = ecs_mask_grow(system->component_writes, component_id - 1);
+        ecs_mask_set(system->component_writes, component_id - 1);
+    }
+
+    system->declared = 1;
+
+    return(1);
+}
+
+int
+ecs_world_system_resource_access(
+    ecs_world *world,
+    size_t system_id,
+    size_t resource_id,
+    int access)
+{
+    ecs_system *system;
+
+    system = ecs_world_system_get(world, system_id);
+    if(!system || !(access & (ECS_READ | ECS_WRITE)) ||
+       resource_id == 0 || resource_id > da_len(world->resources) || world->resources[resource_id - 1].destroyed)
+    {
+        return(0);
+    }
+
+    system->resource_reads = ecs_mask_grow(system->resource_reads, resource_id - 1);
+    ecs_mask_set(system->resource_reads, resource_id - 1);
+    if(access & ECS_WRITE)
+    {
+        system->resource_writes = ecs_mask_grow(system->resource_writes, resource_id - 1);
+        ecs_mask_set(system->resource_writes, resource_id - 1);
+    }
+
+    system->declared = 1;
+
+    return(1);
+}
+
+void
+ecs_world_fixed_step_set(ecs_world *world, float step)
+{
+    if(step > 0.0f)
+    {
+        world->fixed_step = step;
+    }
+}
+
+/* Advances the clock of a rate-limited system, 1 when it is due this frame */
+int
+ecs_system_due(ecs_system *system, float dt, float *elapsed)
+{
+    *elapsed = dt;
+    if(system->period <= 0.0f)
+    {
+        return(1);
+    }
+
+    system->elapsed += dt;
+    system->wait -= dt;
+    if(system->wait > 0.0f)
+    {
+        return(0);
+    }
+
+    *elapsed = system->elapsed;
+    system->elapsed = 0.0f;
+
+    /* Keep the phase of the schedule, unless a long frame left it behind */
+    system->wait += system->period;
+    if(system->wait <= 0.0f)
+    {
+        system->wait = system->period;
+    }
+
+    return(1);
+}
+
+/* Prefab */
+
+size_t
+ecs_world_prefab_create(ecs_world *world)
+{
+    ecs_prefab prefab = {0};
+
+    da_push(world->prefabs, prefab);
+
+    return(da_len(world->prefabs));
+}
+
+ecs_prefab*
+ecs_world_prefab_get(ecs_world *world, size_t prefab_id)
+{
+    ecs_prefab *prefab;
+
+    if(prefab_id == 0 || prefab_id > da_len(world->prefabs))
+    {
+        return(0);
+    }
+
+    prefab = &(world->prefabs[prefab_id - 1]);
+    if(prefab->destroyed)
+    {
+        return(0);
+    }
+
+    return(prefab);
+}
+
+void
+ecs_prefab_free(ecs_prefab *prefab)
+{
+    size_t i;
+
+    for(i = 0;
+        i < da_len(prefab->components_data);
+        ++i)
+    {
+        ecs_free(prefab->components_data[i]);
+    }
+
+    da_free(prefab->component_mask);
+    da_free(prefab->components_ids);
+    da_free(prefab->components_data);
+
+    prefab->component_mask = 0;
+    prefab->components_ids = 0;
+    prefab->components_data = 0;
+}
+
+void
+ecs_world_prefab_destroy(ecs_world *world, size_t prefab_id)
+{
+    ecs_prefab *prefab;
+
+    prefab = ecs_world_prefab_get(world, prefab_id);
+    if(!prefab)
+    {
+        return;
+    }
+
+    ecs_prefab_free(prefab);
+    prefab->destroyed = 1;
+}
+
+void*
+ecs_world_prefab_component_get(
+    ecs_world *world,
+    size_t prefab_id,
+    size_t component_id)
+{
+    ecs_prefab *prefab;
+    size_t i;
+
+    prefab = ecs_world_prefab_get(world, prefab_id);
+    if(!prefab)
+    {
+        return(0);
+    }
+
+    for(i = 0;
+        i < da_len(prefab->components_ids);
+        ++i)
+    {
+        if(prefab->components_ids[i] == component_id)
+        {
+            return(prefab->components_data[i]);
+        }
+    }
+
+    return(0);
+}
+
+void*
+ecs_world_prefab_component_attach(
+    ecs_world *world,
+    size_t prefab_id,
+    size_t component_id)
+{
+    ecs_prefab *prefab;
+    ecs_component_list *list;
+    void *data;
+
+    prefab = ecs_world_prefab_get(world, prefab_id);
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!prefab || !list)
+    {
+        return(0);
+    }
+
+    if(ecs_mask_test(prefab->component_mask, da_len(prefab->component_mask), component_id - 1))
+    {
+        return(ecs_world_prefab_component_get(world, prefab_id, component_id));
+    }
+
+    prefab->component_mask = ecs_mask_grow(prefab->component_mask, component_id - 1);
+    ecs_mask_set(prefab->component_mask, component_id - 1);
+
+    if(list->unit_size == 0)
+    {
+        return(0);
+    }
+
+    data = ecs_malloc(list->unit_size);
+    if(!data)
+    {
+        ecs_mask_clear(prefab->component_mask, da_len(prefab->component_mask), component_id - 1);
+        return(0);
+    }
+
+    ecs_mem_zero(data, list->unit_size);
+    da_push(prefab->components_ids, component_id);
+    da_push(prefab->components_data, data);
+
+    return(data);
+}
+
+/* Appends count copies of component as rows for entities first_id..first_id + count - 1 */
+int
+ecs_component_list_add_copies(
+    ecs_component_list *component_list,
+    size_t first_id,
+    size_t count,
+    void *component)
+{
+    size_t needed, copied, i;
+    unsigned char *rows;
+
+    needed = component_list->count + count;
+    if(needed > component_list->cap)
+    {
+        if(!ecs_component_list_resize(component_list, needed))
+        {
+            return(0);
+        }
+    }
+
+    /* One row, then keep doubling the copied block */
+    rows = (unsigned char *)component_list->data + component_list->count*component_list->unit_size;
+    ecs_mem_copy(component, rows, component_list->unit_size);
+    for(copied = 1;
+        copied < count;
+        copied *= 2)
+    {
+        ecs_mem_copy(rows, rows + copied*component_list->unit_size,
+                     ((count - copied < copied) ? count - copied : copied)*component_list->unit_size);
+    }
+
+    if(component_list->buffered)
+    {
+        ecs_mem_copy(rows, (unsigned char *)component_list->data_prev + component_list->count*component_list->unit_size,
+                     count*component_list->unit_size);
+    }
+
+    /* The instance ids are new to the list, no lookups needed */
+    ecs_map_reserve(&component_list->entity_to_index, count);
+    for(i = 0;
+        i < count;
+        ++i)
+    {
+        ecs_map_add(&component_list->entity_to_index, first_id + i, component_list->count + i);
+        da_push(component_list->entities, first_id + i);
+        ecs_component_list_row_disable(component_list, component_list->count + i, 0);
+    }
+
+    component_list->count = needed;
+
+    return(1);
+}
+
+size_t
+ecs_world_entity_instantiate(
+    ecs_world *world,
+    size_t prefab_id,
+    size_t count)
+{
+    ecs_prefab *prefab;
+    size_t first_id, i, j, mask_size;
+
+    prefab = ecs_world_prefab_get(world, prefab_id);
+    if(!prefab || count == 0)
+    {
+        return(0);
+    }
+
+    /* One bump takes the whole range, the instances are first_id..first_id + count - 1
+       even with reservations running on other threads */
+    first_id = ecs_atomic_add(&world->entity_manager.current_id, count) + 1;
+    mask_size = da_len(prefab->component_mask);
+    ecs_map_reserve(&world->entity_manager.id_to_index, count);
+    ecs_map_reserve(&world->entity_manager.index_to_id, count);
+    for(i = 0;
+        i < count;
+        ++i)
+    {
+        ecs_entity *entity;
+
+        entity = ecs_entity_manager_insert(&world->entity_manager, first_id + i);
+        for(j = 0;
+            j < mask_size;
+            ++j)
+        {
+            da_push(entity->component_mask, prefab->component_mask[j]);
+        }
+    }
+
+    for(i = 0;
+        i < da_len(prefab->components_ids);
+        ++i)
+    {
+        ecs_component_list *list;
+        ecs_blob empty = {0};
+
+        /* Variable-size rows own their bytes, instances start empty like attached rows */
+        list = ecs_component_manager_get_list(&world->component_manager, prefab->components_ids[i]);
+        if(list)
+        {
+            ecs_component_list_add_copies(list, first_id, count,
+                                          list->variable ? (void *)&empty : prefab->components_data[i]);
+        }
+    }
+
+    /* Observers and indices see the instances with their default values */
+    for(j = ecs_mask_next(prefab->component_mask, mask_size, 0);
+        j != ECS_MASK_END;
+        j = ecs_mask_next(prefab->component_mask, mask_size, j + 1))
+    {
+        for(i = 0;
+            i < count;
+            ++i)
+        {
+            ecs_world_component_changed(world, first_id + i, j + 1, ECS_EVENT_ADD);
+        }
+    }
+
+    if(world->journal)
+    {
+        for(i = 0;
+            i < count;
+            ++i)
+        {
+            if(!ecs_world_journal_entity(world, world->journal,
+                                         ecs_entity_manager_get(&world->entity_manager, first_id + i)))
+            {
+                world->journal_failed = 1;
+            }
+        }
+    }
+
+    return(first_id);
+}
+
+/* Journal replay */
+
+/* Writes the whole world as journal records, replaying them into a world
+   with the same components registered recreates it */
+int
+ecs_world_journal_snapshot(ecs_world *world, FILE *file)
+{
+    size_t i;
+
+    ecs_world_entities_reserved_flush(world);
+
+    if(!ecs_journal_record_write(file, ECS_JOURNAL_IDS, world->entity_manager.current_id, 0, 0, 0))
+    {
+        return(0);
+    }
+
+    for(i = 0;
+        i < da_len(world->entity_manager.entities);
+        ++i)
+    {
+        ecs_entity *entity;
+
+        entity = &(world->entity_manager.entities[i]);
+        if(entity->destroyed)
+        {
+            continue;
+        }
+
+        if(!ecs_world_journal_entity(world, file, entity))
+        {
+            return(0);
+        }
+    }
+
+    return(1);
+}
+
+/* A record cut short by a crash ends the replay without an error */
+int
+ecs_world_journal_replay(ecs_world *world, FILE *file)
+{
+    ecs_journal_record record;
+    ecs_component_list *list;
+    FILE *journal;
+    void *data;
+    size_t data_cap;
+    int ok;
+
+    /* Replayed changes are already on disk, keep them out of the open journal */
+    journal = world->journal;
+    world->journal = 0;
+
+    data = 0;
+    data_cap = 0;
+    ok = 1;
+    while(fread(&record, sizeof(record), 1, file) == 1)
+    {
+        /* Only writes carry data, sized like a row of their component */
+        list = 0;
+        if(record.type == ECS_JOURNAL_WRITE)
+        {
+            list = ecs_component_manager_get_list(&world->component_manager, record.component_id);
+        }
+
+        if(record.type < ECS_JOURNAL_IDS || record.type > ECS_JOURNAL_WRITE ||
+           (record.type == ECS_JOURNAL_WRITE && (!list || !record.size || (!list->variable && list->unit_size != record.size))) ||
+           (record.type != ECS_JOURNAL_WRITE && record.size))
+        {
+            /* Not a journal, or the components do not match */
+            ok = 0;
+            break;
+        }
+
+        if(record.size)
+        {
+            if(!ecs_mem_reserve(&data, &data_cap, record.size, 1))
+            {
+                ok = 0;
+                break;
+            }
+
+            if(fread(data, record.size, 1, file) != 1)
+            {
+                break;
+            }
+        }
+
+        if(record.type == ECS_JOURNAL_IDS)
+        {
+            if(record.entity_id > world->entity_manager.current_id)
+            {
+                world->entity_manager.current_id = record.entity_id;
+            }
+        }
+        else if(record.type == ECS_JOURNAL_CREATE)
+        {
+            ecs_entity_manager_create_with_id(&world->entity_manager, record.entity_id);
+        }
+        else if(record.type == ECS_JOURNAL_DESTROY)
+        {
+            ecs_world_entity_destroy(world, record.entity_id);
+        }
+        else if(record.type == ECS_JOURNAL_ATTACH)
+        {
+            ecs_world_entity_component_attach(world, record.entity_id, record.component_id);
+        }
+        else if(record.type == ECS_JOURNAL_DETACH)
+        {
+            ecs_world_entity_component_detach(world, record.entity_id, record.component_id);
+        }
+        else
+        {
+            void *component;
+
+            if(list->variable)
+            {
+                component = ecs_world_entity_component_resize(world, record.entity_id, record.component_id, record.size);
+            }
+            else
+            {
+                component = ecs_component_list_get(list, record.entity_id);
+            }
+
+            if(component)
+            {
+                ecs_mem_copy(data, component, record.size);
+                ecs_world_entity_component_modified(world, record.entity_id, record.component_id);
+            }
+        }
+    }
+
+    if(ferror(file))
+    {
+        ok = 0;
+    }
+
+    ecs_free(data);
+    world->journal = journal;
+
+    return(ok);
+}
+
+void
+ecs_world_query_lists_resolve(ecs_world *world, ecs_query_signature *signature)
+{
+    size_t i;
+
+    for(i = 0;
+        i < signature->components_count;
+        ++i)
+    {
+        signature->lists[i] = ecs_component_manager_get_list(&world->component_manager, signature->components_ids[i]);
+        signature->tables[i] = 0;
+    }
+}
+
+/* Once the matches are counted, fills a row table for each list where one
+   walk of the list beats a map lookup per match */
+void
+ecs_world_query_tables_resolve(ecs_world *world, ecs_query_signature *signature, size_t matches)
+{
+    ecs_component_list *list;
+    size_t *table;
+    size_t span, words, i, row;
+
+    span = world->entity_manager.current_id + 1;
+    words = 0;
+    for(i = 0;
+        i < signature->components_count;
+        ++i)
+    {
+        list = signature->lists[i];
+        if(list && list->unit_size && span + list->count <= ECS_QUERY_TABLE_RATIO*matches)
+        {
+            words += span;
+        }
+    }
+
+    if(!words || !ecs_mem_reserve((void **)&signature->table_words, &signature->table_words_cap, words, sizeof(size_t)))
+    {
+        return;
+    }
+
+    table = signature->table_words;
+    for(i = 0;
+        i < signature->components_count;
+        ++i)
+    {
+        list = signature->lists[i];
+        if(!list || !list->unit_size || span + list->count > ECS_QUERY_TABLE_RATIO*matches)
+        {
+            continue;
+        }
+
+        ecs_mem_zero(table, span*sizeof(size_t));
+        for(row = 0;
+            row < list->count;
+            ++row)
+        {
+            if(list->entities[row] < span)
+            {
+                table[list->entities[row]] = row + 1;
+            }
+        }
+
+        signature->tables[i] = table;
+        table += span;
+    }
+}
+
+ecs_query_result*
+ecs_world_query_result_push(ecs_world *world, ecs_query_signature *signature, size_t entities_count)
+{
+    ecs_query_result *result;
+
+    result = (ecs_query_result *)ecs_arena_push(&world->arena,
+        sizeof(ecs_query_result) +
+        entities_count*sizeof(size_t) +
+        entities_count*signature->columns_count*sizeof(void *));
+    if(!result)
+    {
+        return(0);
+    }
+
+    result->count = entities_count;
+    result->components_count = signature->columns_count;
+    result->list = (void **)(result + 1);
+    result->entities = (size_t *)(result->list + entities_count*signature->columns_count);
+
+    return(result);
+}
+
+void
+ecs_query_result_row_fill(
+    ecs_query_signature *signature,
+    ecs_query_result *result,
+    size_t row_index,
+    size_t entity_id)
+{
+    ecs_component_list *list;
+    void **row;
+    size_t i, k, table_row;
+
+    result->entities[row_index] = entity_id;
+
+    row = result->list + row_index*signature->columns_count;
+    for(i = 0;
+        i < signature->columns_count;
+        ++i)
+    {
+        k = signature->columns[i];
+        list = signature->lists[k];
+        row[i] = 0;
+        if(signature->tables[k])
+        {
+            table_row = signature->tables[k][entity_id];
+            if(table_row)
+            {
+                row[i] = (unsigned char *)list->data + (table_row - 1)*list->unit_size;
+            }
+        }
+        else if(list)
+        {
+            row[i] = ecs_component_list_get(list, entity_id);
+        }
+    }
+}
+
+int
+ecs_world_query_slot_match(ecs_world *world, ecs_query_signature *signature, size_t entity_index)
+{
+    ecs_entity *entity;
+
+    entity = &(world->entity_manager.entities[entity_index]);
+    if(entity->dead || entity->destroyed || entity->disabled)
+    {
+        return(0);
+    }
+
+    return(ecs_query_signature_match(signature, entity->component_mask) &&
+           !ecs_mask_intersects(entity->disabled_mask, da_len(entity->disabled_mask),
+                                signature->mask, signature->mask_size));
+}
+
+/* Slots to step over from entity_index, a whole word when all of them are disabled */
+size_t
+ecs_world_query_slot_step(ecs_world *world, size_t entity_index)
+{
+    ecs_entity_manager *entity_manager;
+
+    entity_manager = &world->entity_manager;
+    if(ecs_mask_word_full(entity_manager->disabled, da_len(entity_manager->disabled), entity_index))
+    {
+        return(ECS_MASK_BITS);
+    }
+
+    return(1);
+}
+
+ecs_query_result*
+ecs_world_query_run(ecs_world *world, ecs_query_signature *signature)
+{
+    size_t entity_index;
+    size_t entities_count;
+    ecs_query_result *result;
+
+    ecs_world_query_lists_resolve(world, signature);
+
+    /* Count first so the result is a single exact allocation */
+    entities_count = 0;
+    for(entity_index = 0;
+        entity_index < world->entity_manager.cap;
+        entity_index += ecs_world_query_slot_step(world, entity_index))
+    {
+        entities_count += ecs_world_query_slot_match(world, signature, entity_index);
+    }
+
+    result = ecs_world_query_result_push(world, signature, entities_count);
+    if(!result)
+    {
+        return(0);
+    }
+
+    ecs_world_query_tables_resolve(world, signature, result->count);
+
+    entities_count = 0;
+    for(entity_index = 0;
+        entities_count < result->count;
+        entity_index += ecs_world_query_slot_step(world, entity_index))
+    {
+        if(ecs_world_query_slot_match(world, signature, entity_index))
+        {
+            ecs_query_result_row_fill(signature, result, entities_count++,
+                                      world->entity_manager.entities[entity_index].id);
+        }
+    }
+
+    return(result);
+}
+
+/* Up to budget matches starting at the signature cursor, wrapping around at
+   the end of the entity table. A call visits each slot at most once. */
+ecs_query_result*
+ecs_world_query_run_budget(ecs_world *world, ecs_query_signature *signature, size_t budget)
+{
+    size_t entity_index, scanned, entities_count, cap, step;
+    ecs_query_result *result;
+
+    cap = world->entity_manager.cap;
+    if(signature->cursor >= cap)
+    {
+        signature->cursor = 0;
+    }
+
+    ecs_world_query_lists_resolve(world, signature);
+
+    entities_count = 0;
+    entity_index = signature->cursor;
+    for(scanned = 0;
+        scanned < cap && entities_count < budget;
+        scanned += step)
+    {
+        step = ecs_world_query_slot_step(world, entity_index);
+        if(step == 1)
+        {
+            entities_count += ecs_world_query_slot_match(world, signature, entity_index);
+        }
+
+        entity_index = (entity_index + step < cap) ? entity_index + step : 0;
+
+        /* A skipped word may reach past the slots left to visit */
+        if(step > cap - scanned)
+        {
+            step = cap - scanned;
+        }
+    }
+
+    result = ecs_world_query_result_push(world, signature, entities_count);
+    if(!result)
+    {
+        return(0);
+    }
+
+    ecs_world_query_tables_resolve(world, signature, result->count);
+
+    entities_count = 0;
+    entity_index = signature->cursor;
+    while(entities_count < result->count)
+    {
+        step = ecs_world_query_slot_step(world, entity_index);
+        if(step == 1 && ecs_world_query_slot_match(world, signature, entity_index))
+        {
+            ecs_query_result_row_fill(signature, result, entities_count++,
+                                      world->entity_manager.entities[entity_index].id);
+        }
+
+        entity_index = (entity_index + step < cap) ? entity_index + step : 0;
+    }
+
+    /* The next call resumes right after the last entity returned */
+    if(result->count)
+    {
+        signature->cursor = entity_index;
+    }
+
+    return(result);
+}
+
+ecs_query_result*
+ecs_world_query(ecs_world *world, size_t num_components, va_list args)
+{
+    if(!ecs_query_signature_compile(&world->query_signature, num_components, args))
+    {
+        return(0);
+    }
+
+    return(ecs_world_query_run(world, &world->query_signature));
+}
+
+size_t
+ecs_world_query_create(ecs_world *world, size_t num_components, va_list args)
+{
+    ecs_query_signature signature = {0};
+    size_t query_index;
+    size_t free_slots_length;
+
+    if(!ecs_query_signature_compile(&signature, num_components, args))
+    {
+        ecs_query_signature_free(&signature);
+        return(0);
+    }
+
+    free_slots_length = da_len(world->queries_free_slots);
+    if(free_slots_length > 0)
+    {
+        query_index = world->queries_free_slots[free_slots_length - 1];
+        da_pop(world->queries_free_slots);
+        world->queries[query_index] = signature;
+    }
+    else
+    {
+        query_index = da_len(world->queries);
+        da_push(world->queries, signature);
+    }
+
+    return(query_index + 1);
+}
+
+ecs_query_signature*
+ecs_world_query_get(ecs_world *world, size_t query_id)
+{
+    ecs_query_signature *signature;
+
+    if(query_id == 0 || query_id > da_len(world->queries))
+    {
+        return(0);
+    }
+
+    signature = &(world->queries[query_id - 1]);
+    if(signature->destroyed)
+    {
+        return(0);
+    }
+
+    return(signature);
+}
+
+void
+ecs_world_query_destroy(ecs_world *world, size_t query_id)
+{
+    ecs_query_signature *signature;
+
+    signature = ecs_world_query_get(world, query_id);
+    if(!signature)
+    {
+        return;
+    }
+
+    ecs_query_signature_free(signature);
+    signature->destroyed = 1;
+    da_push(world->queries_free_slots, query_id - 1);
+}
+
+void
+ecs_world_memory(ecs_world *world, ecs_memory_stats *stats)
+{
+    size_t i, j;
+
+    ecs_mem_zero(stats, sizeof(*stats));
+
+    stats->entities += da_len(world->entity_manager.entities)*sizeof(ecs_entity);
+    stats->entities += (da_len(world->entity_manager.free_slots) + da_len(world->entity_manager.disabled))*sizeof(size_t);
+    stats->entities += world->entity_manager.reserved_cap*sizeof(size_t);
+    for(i = 0;
+        i < da_len(world->entity_manager.entities);
+        ++i)
+    {
+        ecs_entity *entity;
+
+        entity = &(world->entity_manager.entities[i]);
+        stats->entities += (da_len(entity->component_mask) + da_len(entity->disabled_mask) +
+                            da_len(entity->children))*sizeof(size_t);
+    }
+
+    stats->maps += ecs_map_memory(&world->entity_manager.id_to_index);
+    stats->maps += ecs_map_memory(&world->entity_manager.index_to_id);
+    stats->maps += ecs_map_memory(&world->component_manager.id_to_index);
+    stats->maps += ecs_map_memory(&world->component_manager.index_to_id);
+
+    stats->components += da_len(world->component_manager.lists)*sizeof(ecs_component_list);
+    stats->components += da_len(world->component_manager.free_slots)*sizeof(size_t);
+    for(i = 0;
+        i < da_len(world->component_manager.lists);
+        ++i)
+    {
+        ecs_component_list *list;
+
+        list = &(world->component_manager.lists[i]);
+        if(list->destroyed)
+        {
+            continue;
+        }
+
+        /* Same bytes as ecs_component_memory, with the row map counted as a map */
+        stats->components += ecs_component_list_memory(list) - ecs_map_memory(&list->entity_to_index);
+        stats->maps += ecs_map_memory(&list->entity_to_index);
+    }
+
+    stats->components += ecs_slab_memory(&world->slab);
+    stats->queries += world->arena.total;
+
+    stats->queries += da_len(world->queries)*sizeof(ecs_query_signature);
+    for(i = 0;
+        i <= da_len(world->queries);
+        ++i)
+    {
+        ecs_query_signature *signature;
+
+        signature = (i < da_len(world->queries)) ? &(world->queries[i]) : &world->query_signature;
+        stats->queries += (signature->mask_cap + signature->components_cap + signature->columns_cap +
+                           signature->table_words_cap)*sizeof(size_t) +
+                          signature->lists_cap*sizeof(ecs_component_list *) +
+                          signature->tables_cap*sizeof(size_t *);
+    }
+
+    for(i = 0;
+        i < da_len(world->resources);
+        ++i)
+    {
+        stats->other += sizeof(ecs_resource);
+        if(!world->resources[i].destroyed)
+        {
+            stats->other += world->resources[i].size;
+        }
+    }
+
+    for(i = 0;
+        i < da_len(world->spatial_indices);
+        ++i)
+    {
+        ecs_spatial_index *index;
+
+        index = &(world->spatial_indices[i]);
+        stats->other += sizeof(ecs_spatial_index) + index->results_cap*sizeof(size_t);
+        if(index->destroyed)
+        {
+            continue;
+        }
+
+        stats->other += ECS_SPATIAL_BUCKETS*sizeof(ecs_spatial_entry *);
+        for(j = 0;
+            j < ECS_SPATIAL_BUCKETS;
+            ++j)
+        {
+            stats->other += da_len(index->buckets[j])*sizeof(ecs_spatial_entry);
+        }
+
+        stats->maps += ecs_map_memory(&index->entity_to_bucket);
+    }
+
+    for(i = 0;
+        i < da_len(world->key_indices);
+        ++i)
+    {
+        ecs_key_index *index;
+
+        index = &(world->key_indices[i]);
+        stats->other += sizeof(ecs_key_index) + index->results_cap*sizeof(size_t);
+        if(index->destroyed)
+        {
+            continue;
+        }
+
+        stats->other += index->bucket_count*sizeof(ecs_key_entry *);
+        for(j = 0;
+            j < index->bucket_count;
+            ++j)
+        {
+            stats->other += da_len(index->buckets[j])*sizeof(ecs_key_entry);
+        }
+
+        stats->maps += ecs_map_memory(&index->entity_to_bucket);
+    }
+
+    for(i = 0;
+        i < da_len(world->observers);
+        ++i)
+    {
+        stats->other += sizeof(ecs_observer) + world->observers[i].pending_cap*sizeof(size_t);
+    }
+
+    for(i = 0;
+        i < da_len(world->systems);
+        ++i)
+    {
+        ecs_system *system;
+
+        system = &(world->systems[i]);
+        stats->other += sizeof(ecs_system) +
+                        (da_len(system->component_reads) + da_len(system->component_writes) +
+                         da_len(system->resource_reads) + da_len(system->resource_writes))*sizeof(size_t);
+    }
+
+    for(i = 0;
+        i < da_len(world->event_channels);
+        ++i)
+    {
+        stats->other += sizeof(ecs_event_channel) +
+                        world->event_channels[i].cap*world->event_channels[i].event_size;
+    }
+
+    if(world->journal_buffer)
+    {
+        stats->other += ECS_JOURNAL_BUFFER;
+    }
+
+    for(i = 0;
+        i < da_len(world->prefabs);
+        ++i)
+    {
+        ecs_prefab *prefab;
+
+        prefab = &(world->prefabs[i]);
+        stats->other += sizeof(ecs_prefab) + da_len(prefab->component_mask)*sizeof(size_t) +
+                        da_len(prefab->components_ids)*(sizeof(size_t) + sizeof(void *));
+        for(j = 0;
+            j < da_len(prefab->components_ids);
+            ++j)
+        {
+            ecs_component_list *list;
+
+            list = ecs_component_manager_get_list(&world->component_manager, prefab->components_ids[j]);
+            stats->other += list ? list->unit_size : 0;
+        }
+    }
+
+    stats->other += (world->hierarchy_entities_cap + world->hierarchy_parents_cap)*sizeof(size_t);
+
+    stats->total = stats->entities + stats->components + stats->maps + stats->queries + stats->other;
+}
+
+/* Renumbers entity slots and puts every column back in entity order, so
+   entities and their rows line up again as in a fresh world. Query,
+   hierarchy and spatial results returned before are invalidated. */
+int
+ecs_world_defragment_storage(ecs_world *world)
+{
+    size_t i;
+
+    ecs_world_entities_reserved_flush(world);
+    if(!ecs_entity_manager_defragment(&world->entity_manager))
+    {
+        return(0);
+    }
+
+    /* Columns share nothing, reorder them in parallel */
+    ecs_parallel_for(da_len(world->component_manager.lists), ecs_component_list_defragment_job,
+                     world->component_manager.lists);
+
+    /* Budgeted runs restart from the first slot */
+    for(i = 0;
+        i < da_len(world->queries);
+        ++i)
+    {
+        world->queries[i].cursor = 0;
+    }
+
+    world->hierarchy_dirty = 1;
+
+    return(1);
+}
+
+/* Gives slack back to the allocator. Query, hierarchy and spatial results
+   returned before this call are invalidated. */
+void
+ecs_world_compact_storage(ecs_world *world)
+{
+    size_t i, j;
+
+    ecs_map_compact(&world->entity_manager.id_to_index);
+    ecs_map_compact(&world->entity_manager.index_to_id);
+    ecs_map_compact(&world->component_manager.id_to_index);
+    ecs_map_compact(&world->component_manager.index_to_id);
+
+    for(i = 0;
+        i < da_len(world->component_manager.lists);
+        ++i)
+    {
+        ecs_component_list *list;
+
+        list = &(world->component_manager.lists[i]);
+        if(!list->destroyed)
+        {
+            ecs_component_list_compact(list);
+        }
+    }
+
+    ecs_arena_free(&world->arena);
+
+    /* Row tables are rebuilt by the next run */
+    for(i = 0;
+        i <= da_len(world->queries);
+        ++i)
+    {
+        ecs_query_signature *signature;
+
+        signature = (i < da_len(world->queries)) ? &(world->queries[i]) : &world->query_signature;
+        ecs_free(signature->table_words);
+        signature->table_words = 0;
+        signature->table_words_cap = 0;
+    }
+
+    for(i = 0;
+        i < da_len(world->spatial_indices);
+        ++i)
+    {
+        ecs_spatial_index *index;
+
+        index = &(world->spatial_indices[i]);
+        ecs_free(index->results);
+        index->results = 0;
+        index->results_count = 0;
+        index->results_cap = 0;
+
+        if(index->destroyed)
+        {
+            continue;
+        }
+
+        for(j = 0;
+            j < ECS_SPATIAL_BUCKETS;
+            ++j)
+        {
+            if(index->buckets[j] && !da_len(index->buckets[j]))
+            {
+                da_free(index->buckets[j]);
+                index->buckets[j] = 0;
+            }
+        }
+
+        ecs_map_compact(&index->entity_to_bucket);
+    }
+
+    for(i = 0;
+        i < da_len(world->key_indices);
+        ++i)
+    {
+        ecs_key_index *index;
+
+        index = &(world->key_indices[i]);
+        ecs_free(index->results);
+        index->results = 0;
+        index->results_count = 0;
+        index->results_cap = 0;
+
+        if(index->destroyed)
+        {
+            continue;
+        }
+
+        if(ecs_key_index_buckets_for(index->count) < index->bucket_count)
+        {
+            ecs_key_index_rehash(index, ecs_key_index_buckets_for(index->count));
+        }
+
+        for(j = 0;
+            j < index->bucket_count;
+            ++j)
+        {
+            if(index->buckets[j] && !da_len(index->buckets[j]))
+            {
+                da_free(index->buckets[j]);
+                index->buckets[j] = 0;
+            }
+        }
+
+        ecs_map_compact(&index->entity_to_bucket);
+    }
+
+    for(i = 0;
+        i < da_len(world->observers);
+        ++i)
+    {
+        ecs_observer *observer;
+
+        observer = &(world->observers[i]);
+        if(!observer->pending_count)
+        {
+            ecs_free(observer->pending);
+            observer->pending = 0;
+            observer->pending_cap = 0;
+        }
+    }
+
+    ecs_free(world->hierarchy.entities);
+    ecs_free(world->hierarchy.parents);
+    world->hierarchy.entities = 0;
+    world->hierarchy.parents = 0;
+    world->hierarchy.count = 0;
+    world->hierarchy_entities_cap = 0;
+    world->hierarchy_parents_cap = 0;
+    world->hierarchy_dirty = 1;
+}
+
+/* Deep copy of src into the empty world dst, entity and component ids are kept */
+int
+ecs_world_copy(ecs_world *dst, ecs_world *src)
+{
+    size_t i, j;
+    int ok;
+
+    ok = 1;
+
+    /* Entities */
+    dst->entity_manager.current_id = src->entity_manager.current_id;
+    dst->entity_manager.cap = src->entity_manager.cap;
+    for(i = 0;
+        i < da_len(src->entity_manager.entities);
+        ++i)
+    {
+        ecs_entity entity;
+
+        entity = src->entity_manager.entities[i];
+        entity.component_mask = ecs_ids_clone(entity.component_mask);
+        entity.disabled_mask = ecs_ids_clone(entity.disabled_mask);
+        entity.children = ecs_ids_clone(entity.children);
+        da_push(dst->entity_manager.entities, entity);
+    }
+
+    if(!ecs_map_clone(&dst->entity_manager.id_to_index, &src->entity_manager.id_to_index) ||
+       !ecs_map_clone(&dst->entity_manager.index_to_id, &src->entity_manager.index_to_id))
+    {
+        ok = 0;
+    }
+
+    dst->entity_manager.free_slots = ecs_ids_clone(src->entity_manager.free_slots);
+    dst->entity_manager.disabled = ecs_ids_clone(src->entity_manager.disabled);
+
+    /* Pending reservations come along so their ids stay valid in the copy */
+    dst->entity_manager.reserved = (size_t *)ecs_mem_clone(src->entity_manager.reserved,
+                                                           src->entity_manager.reserved_cap*sizeof(size_t),
+                                                           src->entity_manager.reserved_cap*sizeof(size_t));
+    if(src->entity_manager.reserved_cap && !dst->entity_manager.reserved)
+    {
+        ok = 0;
+    }
+    else
+    {
+        dst->entity_manager.reserved_cap = src->entity_manager.reserved_cap;
+        dst->entity_manager.reserved_count = src->entity_manager.reserved_count;
+    }
+
+    /* Components, one copy per column */
+    dst->component_manager.current_id = src->component_manager.current_id;
+    dst->component_manager.cap = src->component_manager.cap;
+    for(i = 0;
+        i < da_len(src->component_manager.lists);
+        ++i)
+    {
+        ecs_component_list list;
+
+        list = src->component_manager.lists[i];
+        if(!list.destroyed)
+        {
+            if(!ecs_map_clone(&list.entity_to_index, &src->component_manager.lists[i].entity_to_index))
+            {
+                ok = 0;
+            }
+
+            list.entities = ecs_ids_clone(list.entities);
+            list.disabled = ecs_ids_clone(list.disabled);
+            list.data = ecs_mem_clone(list.data, list.cap*list.unit_size, list.count*list.unit_size);
+            list.data_prev = ecs_mem_clone(list.data_prev, list.cap*list.unit_size, list.count*list.unit_size);
+            if(list.variable && list.data)
+            {
+                /* Each clone owns its bytes */
+                for(j = 0;
+                    j < list.count;
+                    ++j)
+                {
+                    ecs_blob *blob;
+                    void *data;
+
+                    blob = &(((ecs_blob *)list.data)[j]);
+                    data = ecs_slab_alloc(&dst->slab, blob->size);
+                    if(blob->size && !data)
+                    {
+                        blob->size = 0;
+                        ok = 0;
+                    }
+
+                    ecs_mem_copy(blob->data, data, blob->size);
+                    blob->data = data;
+                }
+            }
+
+            if(list.cap > 0 && list.unit_size > 0 && (!list.data || (list.buffered && !list.data_prev)))
+            {
+                ecs_free(list.data);
+                ecs_free(list.data_prev);
+                list.data = 0;
+                list.data_prev = 0;
+                list.cap = 0;
+                list.count = 0;
+                ok = 0;
+            }
+        }
+        else
+        {
+            ecs_mem_zero(&list.entity_to_index, sizeof(list.entity_to_index));
+            list.entities = 0;
+            list.data = 0;
+            list.data_prev = 0;
+        }
+
+        da_push(dst->component_manager.lists, list);
+    }
+
+    if(!ecs_map_clone(&dst->component_manager.id_to_index, &src->component_manager.id_to_index) ||
+       !ecs_map_clone(&dst->component_manager.index_to_id, &src->component_manager.index_to_id))
+    {
+        ok = 0;
+    }
+
+    dst->component_manager.free_slots = ecs_ids_clone(src->component_manager.free_slots);
+
+    /* Compiled queries keep their ids */
+    for(i = 0;
+        i < da_len(src->queries);
+        ++i)
+    {
+        ecs_query_signature signature = {0};
+        ecs_query_signature *source;
+
+        source = &(src->queries[i]);
+        signature.destroyed = source->destroyed;
+        for(j = 0;
+            !source->destroyed && j < source->columns_count;
+            ++j)
+        {
+            ok = ecs_query_signature_add(&signature, source->components_ids[source->columns[j]]) && ok;
+        }
+
+        da_push(dst->queries, signature);
+    }
+
+    dst->queries_free_slots = ecs_ids_clone(src->queries_free_slots);
+
+    /* Resources */
+    for(i = 0;
+        i < da_len(src->resources);
+        ++i)
+    {
+        ecs_resource resource;
+
+        resource = src->resources[i];
+        resource.data = ecs_mem_clone(resource.data, resource.size, resource.size);
+        if(!resource.destroyed && !resource.data)
+        {
+            resource.destroyed = 1;
+            ok = 0;
+        }
+
+        da_push(dst->resources, resource);
+    }
+
+    dst->resources_free_slots = ecs_ids_clone(src->resources_free_slots);
+
+    /* Spatial indices */
+    for(i = 0;
+        i < da_len(src->spatial_indices);
+        ++i)
+    {
+        ecs_spatial_index index;
+        ecs_spatial_index *source;
+
+        source = &(src->spatial_indices[i]);
+        index = *source;
+        index.buckets = 0;
+        ecs_mem_zero(&index.entity_to_bucket, sizeof(index.entity_to_bucket));
+        index.results = 0;
+        index.results_count = 0;
+        index.results_cap = 0;
+
+        if(!source->destroyed)
+        {
+            index.buckets = (ecs_spatial_entry **)ecs_malloc(ECS_SPATIAL_BUCKETS*sizeof(ecs_spatial_entry *));
+            if(index.buckets)
+            {
+                for(j = 0;
+                    j < ECS_SPATIAL_BUCKETS;
+                    ++j)
+                {
+                    size_t k;
+
+                    index.buckets[j] = 0;
+                    for(k = 0;
+                        k < da_len(source->buckets[j]);
+                        ++k)
+                    {
+                        da_push(index.buckets[j], source->buckets[j][k]);
+                    }
+                }
+
+                if(!ecs_map_clone(&index.entity_to_bucket, &source->entity_to_bucket))
+                {
+                    ok = 0;
+                }
+            }
+            else
+            {
+                index.destroyed = 1;
+                ok = 0;
+            }
+        }
+
+        da_push(dst->spatial_indices, index);
+    }
+
+    /* Key indices */
+    for(i = 0;
+        i < da_len(src->key_indices);
+        ++i)
+    {
+        ecs_key_index index;
+        ecs_key_index *source;
+
+        source = &(src->key_indices[i]);
+        index = *source;
+        index.buckets = 0;
+        ecs_mem_zero(&index.entity_to_bucket, sizeof(index.entity_to_bucket));
+        index.results = 0;
+        index.results_count = 0;
+        index.results_cap = 0;
+
+        if(!source->destroyed)
+        {
+            index.buckets = (ecs_key_entry **)ecs_malloc(source->bucket_count*sizeof(ecs_key_entry *));
+            if(index.buckets)
+            {
+                for(j = 0;
+                    j < source->bucket_count;
+                    ++j)
+                {
+                    size_t k;
+
+                    index.buckets[j] = 0;
+                    for(k = 0;
+                        k < da_len(source->buckets[j]);
+                        ++k)
+                    {
+                        da_push(index.buckets[j], source->buckets[j][k]);
+                    }
+                }
+
+                if(!ecs_map_clone(&index.entity_to_bucket, &source->entity_to_bucket))
+                {
+                    ok = 0;
+                }
+            }
+            else
+            {
+                index.destroyed = 1;
+                ok = 0;
+            }
+        }
+
+        da_push(dst->key_indices, index);
+    }
+
+    /* Prefabs */
+    for(i = 0;
+        i < da_len(src->prefabs);
+        ++i)
+    {
+        ecs_prefab prefab;
+        ecs_prefab *source;
+
+        source = &(src->prefabs[i]);
+        prefab.component_mask = ecs_ids_clone(source->component_mask);
+        prefab.components_ids = 0;
+        prefab.components_data = 0;
+        prefab.destroyed = source->destroyed;
+        for(j = 0;
+            j < da_len(source->components_ids);
+            ++j)
+        {
+            ecs_component_list *list;
+            void *data;
+
+            list = ecs_component_manager_get_list(&src->component_manager, source->components_ids[j]);
+            data = list ? ecs_mem_clone(source->components_data[j], list->unit_size, list->unit_size) : 0;
+            if(!data)
+            {
+                ok = 0;
+                continue;
+            }
+
+            da_push(prefab.components_ids, source->components_ids[j]);
+            da_push(prefab.components_data, data);
+        }
+
+        da_push(dst->prefabs, prefab);
+    }
+
+    /* The pipeline comes along with its schedule, a prediction step runs the same systems */
+    for(i = 0;
+        i < da_len(src->systems);
+        ++i)
+    {
+        ecs_system system;
+
+        system = src->systems[i];
+        system.component_reads = ecs_ids_clone(system.component_reads);
+        system.component_writes = ecs_ids_clone(system.component_writes);
+        system.resource_reads = ecs_ids_clone(system.resource_reads);
+        system.resource_writes = ecs_ids_clone(system.resource_writes);
+        da_push(dst->systems, system);
+    }
+
+    dst->fixed_step = src->fixed_step;
+    dst->fixed_accumulator = src->fixed_accumulator;
+
+    /* Events of the current frame */
+    for(i = 0;
+        i < da_len(src->event_channels);
+        ++i)
+    {
+        ecs_event_channel channel;
+        size_t count;
+
+        channel = src->event_channels[i];
+        ecs_event_channel_read(&channel, &count);
+        channel.data = (unsigned char *)ecs_mem_clone(channel.data, channel.cap*channel.event_size,
+                                                      count*channel.event_size);
+        channel.count = count;
+        channel.committed = count;
+        if(channel.cap && !channel.data)
+        {
+            channel.cap = 0;
+            channel.count = 0;
+            channel.committed = 0;
+            ok = 0;
+        }
+
+        da_push(dst->event_channels, channel);
+    }
+
+    dst->hierarchy_dirty = 1;
+
+    return(ok);
+}
+
+typedef struct
+ecs_world_manager
+{
+    ecs_map id_to_index;
+    ecs_map index_to_id;
+
+    ecs_world *worlds;
+    size_t cap;
+    size_t current_id;
+
+    size_t *free_slots;
+} ecs_world_manager;
+
+size_t
+ecs_world_manager_create(ecs_world_manager *world_manager)
+{
+    size_t world_id, world_index;
+    ecs_world world = {0};
+    size_t free_slots_length;
+
+    /* TODO: Check index in free_slots first */
+    world_id = ++world_manager->current_id;
+    world.id = world_id;
+
+    free_slots_length = da_len(world_manager->free_slots);
+    if(free_slots_length > 0)
+    {
+        world_index = world_manager->free_slots[free_slots_length - 1];
+        da_pop(world_manager->free_slots);
+        world_manager->worlds[world_index] = world;
+    }
+    else
+    {
+        world_index = da_len(world_manager->worlds);
+        da_push(world_manager->worlds, world);
+        world_manager->cap += 1;
+    }
+
+    ecs_map_set(&world_manager->id_to_index, world_id, world_index);
+    ecs_map_set(&world_manager->index_to_id, world_index, world_id);
+
+    return(world_id);
+}
+
+void
+ecs_world_manager_destroy(
+    ecs_world_manager *world_manager,
+    size_t world_id)
+{
+    size_t *world_index_ptr, world_index;
+    size_t entity_index, component_index, query_index, resource_index, spatial_index, key_index, observer_index;
+    size_t system_index;
+    ecs_world *world;
+
+    world_index_ptr = ecs_map_get(&world_manager->id_to_index, world_id);
+    if(!world_index_ptr)
+    {
+        return;
+    }
+
+    world_index = *world_index_ptr;
+    world = &(world_manager->worlds[world_index]);
+
+    da_push(world_manager->free_slots, world_index);
+    ecs_map_unset(&world_manager->id_to_index, world_id);
+    ecs_map_unset(&world_manager->index_to_id, world_index);
+
+    /* The whole world goes away, so release storage in bulk instead of
+       destroying entities and unregistering components one by one */
+    for(entity_index = 0;
+        entity_index < world->entity_manager.cap;
+        ++entity_index)
+    {
+        ecs_entity *entity;
+
+        entity = &(world->entity_manager.entities[entity_index]);
+        da_free(entity->component_mask);
+        da_free(entity->disabled_mask);
+        da_free(entity->children);
+    }
+
+    da_free(world->entity_manager.entities);
+    da_free(world->entity_manager.free_slots);
+    da_free(world->entity_manager.disabled);
+    ecs_free(world->entity_manager.reserved);
+
+    world->entity_manager.current_id = 0;
+    world->entity_manager.cap = 0;
+    world->entity_manager.entities = 0;
+    world->entity_manager.free_slots = 0;
+    world->entity_manager.disabled = 0;
+    world->entity_manager.reserved = 0;
+    world->entity_manager.reserved_cap = 0;
+    world->entity_manager.reserved_count = 0;
+
+    ecs_map_free(&world->entity_manager.id_to_index);
+    ecs_map_free(&world->entity_manager.index_to_id);
+
+    /* Slab chunks go in one piece, only blocks above the largest class are freed one by one */
+    for(component_index = 0;
+        component_index < da_len(world->component_manager.lists);
+        ++component_index)
+    {
+        ecs_component_list *list;
+        size_t row;
+
+        list = &(world->component_manager.lists[component_index]);
+        if(list->destroyed || !list->variable)
+        {
+            continue;
+        }
+
+        for(row = 0;
+            row < list->count;
+            ++row)
+        {
+            ecs_blob *blob;
+
+            blob = &(((ecs_blob *)list->data)[row]);
+            if(ecs_slab_class(blob->size) == ECS_SLAB_CLASSES)
+            {
+                ecs_slab_free(&world->slab, blob->data, blob->size);
+            }
+        }
+    }
+
+    ecs_slab_destroy(&world->slab);
+
+    /* Component lists share nothing, release them in parallel */
+    ecs_parallel_for(world->component_manager.cap, ecs_component_list_release_job, world->component_manager.lists);
+
+    da_free(world->component_manager.lists);
+    da_free(world->component_manager.free_slots);
+
+    world->component_manager.current_id = 0;
+    world->component_manager.cap = 0;
+    world->component_manager.lists = 0;
+    world->component_manager.free_slots = 0;
+
+    ecs_map_free(&world->component_manager.id_to_index);
+    ecs_map_free(&world->component_manager.index_to_id);
+
+    ecs_arena_free(&world->arena);
+
+    ecs_query_signature_free(&world->query_signature);
+
+    for(query_index = 0;
+        query_index < da_len(world->queries);
+        ++query_index)
+    {
+        ecs_query_signature_free(&(world->queries[query_index]));
+    }
+
+    da_free(world->queries);
+    da_free(world->queries_free_slots);
+    world->queries = 0;
+    world->queries_free_slots = 0;
+
+    for(resource_index = 0;
+        resource_index < da_len(world->resources);
+        ++resource_index)
+    {
+        ecs_free(world->resources[resource_index].data);
+    }
+
+    da_free(world->resources);
+    da_free(world->resources_free_slots);
+    world->resources = 0;
+    world->resources_free_slots = 0;
+
+    for(spatial_index = 0;
+        spatial_index < da_len(world->spatial_indices);
+        ++spatial_index)
+    {
+        ecs_spatial_index_free(&(world->spatial_indices[spatial_index]));
+    }
+
+    da_free(world->spatial_indices);
+    world->spatial_indices = 0;
+
+    for(key_index = 0;
+        key_index < da_len(world->key_indices);
+        ++key_index)
+    {
+        ecs_key_index_free(&(world->key_indices[key_index]));
+    }
+
+    da_free(world->key_indices);
+    world->key_indices = 0;
+
+    for(observer_index = 0;
+        observer_index < da_len(world->observers);
+        ++observer_index)
+    {
+        ecs_free(world->observers[observer_index].pending);
+    }
+
+    da_free(world->observers);
+    world->observers = 0;
+
+    for(system_index = 0;
+        system_index < da_len(world->systems);
+        ++system_index)
+    {
+        ecs_system_free(&(world->systems[system_index]));
+    }
+
+    da_free(world->systems);
+    world->systems = 0;
+
+    for(observer_index = 0;
+        observer_index < da_len(world->event_channels);
+        ++observer_index)
+    {
+        ecs_free(world->event_channels[observer_index].data);
+    }
+
+    da_free(world->event_channels);
+    world->event_channels = 0;
+
+    for(observer_index = 0;
+        observer_index < da_len(world->prefabs);
+        ++observer_index)
+    {
+        ecs_prefab_free(&(world->prefabs[observer_index]));
+    }
+
+    da_free(world->prefabs);
+    world->prefabs = 0;
+
+    ecs_world_journal_close(world);
+
+    ecs_free(world->hierarchy.entities);
+    ecs_free(world->hierarchy.parents);
+    world->hierarchy.entities = 0;
+    world->hierarchy.parents = 0;
+    world->hierarchy.count = 0;
+    world->hierarchy_entities_cap = 0;
+    world->hierarchy_parents_cap = 0;
+
+    world->destroyed = 1;
+}
+
+ecs_world *
+ecs_world_manager_get_at(
+    ecs_world_manager *world_manager,
+    size_t world_index)
+{
+    if(world_index >= world_manager->cap)
+    {
+        return(0);
+    }
+
+    return(&(world_manager->worlds[world_index]));
+}
+
+ecs_world *
+ecs_world_manager_get(
+    ecs_world_manager *world_manager,
+    size_t world_id)
+{
+    size_t *world_index_ptr, world_index;
+
+    world_index_ptr = ecs_map_get(&world_manager->id_to_index, world_id);
+    if(!world_index_ptr)
+    {
+        return(0);
+    }
+
+    world_index = *world_index_ptr;
+
+    return(ecs_world_manager_get_at(world_manager, world_index));
+}
+
+typedef struct
+ecs_context
+{
+    ecs_world_manager world_manager;
+    size_t current_world_id;
+} ecs_context;
+
+ecs_context ecs_instance = {0};
+
+size_t
+ecs_world_create(void)
+{
+    size_t world_id;
+
+    world_id = ecs_world_manager_create(&ecs_instance.world_manager);
+    ecs_instance.current_world_id = world_id;
+
+    return(world_id);
+}
+
+size_t
+ecs_world_clone(size_t world_id)
+{
+    size_t clone_id;
+    ecs_world *world, *clone;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, world_id);
+    if(!world || world->dead)
+    {
+        return(0);
+    }
+
+    /* Creating the clone can move the worlds array, look the source up again */
+    clone_id = ecs_world_manager_create(&ecs_instance.world_manager);
+    world = ecs_world_manager_get(&ecs_instance.world_manager, world_id);
+    clone = ecs_world_manager_get(&ecs_instance.world_manager, clone_id);
+
+    if(!ecs_world_copy(clone, world))
+    {
+        ecs_world_manager_destroy(&ecs_instance.world_manager, clone_id);
+        return(0);
+    }
+
+    return(clone_id);
+}
+
+void
+ecs_world_memory_stats(size_t world_id, ecs_memory_stats *stats)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, world_id);
+    if(!world)
+    {
+        ecs_mem_zero(stats, sizeof(*stats));
+        return;
+    }
+
+    ecs_world_memory(world, stats);
+}
+
+void
+ecs_world_compact(size_t world_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    ecs_world_compact_storage(world);
+}
+
+int
+ecs_world_defragment(size_t world_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_defragment_storage(world));
+}
+
+void
+ecs_world_destroy(size_t world_id)
+{
+    size_t *world_index_ptr, world_index;
+    ecs_world *world;
+
+    world_index_ptr = ecs_map_get(&ecs_instance.world_manager.id_to_index, world_id);
+    if(!world_index_ptr)
+    {
+        return;
+    }
+
+    world_index = *world_index_ptr;
+
+    world = &(ecs_instance.world_manager.worlds[world_index]);
+    world->dead = 1;
+}
+
+void
+ecs_world_current_set(size_t world_id)
+{
+    ecs_instance.current_world_id = world_id;
+}
+
+size_t
+ecs_world_current_get(void)
+{
+    return(ecs_instance.current_world_id);
+}
+
+ecs_query_result*
+ecs_query(size_t num_components, ...)
+{
+    ecs_query_result *result;
+    ecs_world *world;
+    va_list args;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world || world->dead)
+    {
+        return(0);
+    }
+
+    va_start(args, num_components);
+    result = ecs_world_query(world, num_components, args);
+    va_end(args);
+
+    return(result);
+}
+
+size_t
+ecs_query_create(size_t num_components, ...)
+{
+    size_t query_id;
+    ecs_world *world;
+    va_list args;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world || world->dead)
+    {
+        return(0);
+    }
+
+    va_start(args, num_components);
+    query_id = ecs_world_query_create(world, num_components, args);
+    va_end(args);
+
+    return(query_id);
+}
+
+void
+ecs_query_destroy(size_t query_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    ecs_world_query_destroy(world, query_id);
+}
+
+ecs_query_result*
+ecs_query_run(size_t query_id)
+{
+    ecs_world *world;
+    ecs_query_signature *signature;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world || world->dead)
+    {
+        return(0);
+    }
+
+    signature = ecs_world_query_get(world, query_id);
+    if(!signature)
+    {
+        return(0);
+    }
+
+    return(ecs_world_query_run(world, signature));
+}
+
+ecs_query_result*
+ecs_query_run_budget(size_t query_id, size_t budget)
+{
+    ecs_world *world;
+    ecs_query_signature *signature;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world || world->dead)
+    {
+        return(0);
+    }
+
+    signature = ecs_world_query_get(world, query_id);
+    if(!signature)
+    {
+        return(0);
+    }
+
+    return(ecs_world_query_run_budget(world, signature, budget));
+}
+
+void
+ecs_entity_parent_set(size_t entity_id, size_t parent_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    ecs_world_entity_parent_set(world, entity_id, parent_id);
+}
+
+size_t
+ecs_entity_parent_get(size_t entity_id)
+{
+    ecs_world *world;
+    ecs_entity *entity;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
+    if(!entity)
+    {
+        return(0);
+    }
+
+    return(entity->parent);
+}
+
+size_t*
+ecs_entity_children(size_t entity_id, size_t *count)
+{
+    ecs_world *world;
+    ecs_entity *entity;
+
+    *count = 0;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
+    if(!entity)
+    {
+        return(0);
+    }
+
+    *count = da_len(entity->children);
+
+    return(entity->children);
+}
+
+void
+ecs_entity_destroy_tree(size_t entity_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    ecs_world_entity_destroy_tree(world, entity_id);
+}
+
+ecs_hierarchy_result*
+ecs_hierarchy(void)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world || world->dead)
+    {
+        return(0);
+    }
+
+    return(ecs_world_hierarchy(world));
+}
+
+size_t
+ecs_entity_create(void)
+{
+    size_t entity_id;
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    entity_id = ecs_world_entity_create(world);
+
+    return(entity_id);
+}
+
+int
+ecs_entity_reserve_capacity(size_t count)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_entity_manager_reserve_capacity(&world->entity_manager, count));
+}
+
+size_t
+ecs_entity_reserve(void)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_entity_manager_reserve(&world->entity_manager));
+}
+
+void
+ecs_entity_reserved_flush(void)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    ecs_world_entities_reserved_flush(world);
+}
+
+void
+ecs_entity_destroy(size_t entity_id)
+{
+    ecs_world *world;
+    ecs_entity *entity;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
+    if(!entity)
+    {
+        return;
+    }
+
+    entity->dead = 1;
+    if(entity->parent || entity->children)
+    {
+        world->hierarchy_dirty = 1;
+    }
+}
+
+size_t
+ecs_component_register(size_t component_size)
+{
+    size_t component_id;
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    component_id = ecs_component_manager_register(&world->component_manager, component_size);
+
+    return(component_id);
+}
+
+void
+ecs_component_unregister(size_t component_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    ecs_world_component_unregister(world, component_id);
+}
+
+size_t
+ecs_component_register_variable(void)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_component_register_variable(world));
+}
+
+void
+ecs_entity_component_attach(size_t entity_id, size_t component_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    ecs_world_entity_component_attach(world, entity_id, component_id);
+}
+
+void
+ecs_entity_component_detach(size_t entity_id, size_t component_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    ecs_world_entity_component_detach(world, entity_id, component_id);
+}
+
+int
+ecs_entity_component_has(size_t entity_id, size_t component_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_entity_component_has(world, entity_id, component_id));
+}
+
+void*
+ecs_entity_component_get(size_t entity_id, size_t component_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_entity_component_get(world, entity_id, component_id));
+}
+
+void*
+ecs_entity_component_resize(size_t entity_id, size_t component_id, size_t size)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_entity_component_resize(world, entity_id, component_id, size));
+}
+
+void
+ecs_entity_enable(size_t entity_id, int enable)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    ecs_world_entity_enable(world, entity_id, enable);
+}
+
+int
+ecs_entity_enabled(size_t entity_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_entity_enabled(world, entity_id));
+}
+
+void
+ecs_entity_component_enable(size_t entity_id, size_t component_id, int enable)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    ecs_world_entity_component_enable(world, entity_id, component_id, enable);
+}
+
+int
+ecs_entity_component_enabled(size_t entity_id, size_t component_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_entity_component_enabled(world, entity_id, component_id));
+}
+
+size_t*
+ecs_component_disabled(size_t component_id, size_t *words_count)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        *words_count = 0;
+        return(0);
+    }
+
+    return(ecs_world_component_disabled(world, component_id, words_count));
+}
+
+size_t*
+ecs_component_rows(const size_t *components_ids, size_t num_components, size_t *count)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        *count = 0;
+        return(0);
+    }
+
+    return(ecs_world_component_rows(world, components_ids, num_components, count));
+}
+
+size_t
+ecs_resource_register(size_t resource_size)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_resource_register(world, resource_size));
+}
+
+void
+ecs_resource_unregister(size_t resource_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    ecs_world_resource_unregister(world, resource_id);
+}
+
+void*
+ecs_resource_get(size_t resource_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_resource_get(world, resource_id));
+}
+
+size_t
+ecs_event_channel_register(size_t event_size, size_t capacity)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_event_channel_register(world, event_size, capacity));
+}
+
+void
+ecs_event_channel_unregister(size_t channel_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    ecs_world_event_channel_unregister(world, channel_id);
+}
+
+int
+ecs_event_send(size_t channel_id, const void *event)
+{
+    ecs_world *world;
+    ecs_event_channel *channel;
+    void *slot;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    channel = ecs_world_event_channel_get(world, channel_id);
+    slot = channel ? ecs_event_channel_reserve(channel, 1) : 0;
+    if(!slot)
+    {
+        return(0);
+    }
+
+    ecs_mem_copy((void *)event, slot, channel->event_size);
+
+    return(1);
+}
+
+void*
+ecs_event_reserve(size_t channel_id, size_t count)
+{
+    ecs_world *world;
+    ecs_event_channel *channel;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    channel = ecs_world_event_channel_get(world, channel_id);
+    if(!channel)
+    {
+        return(0);
+    }
+
+    return(ecs_event_channel_reserve(channel, count));
+}
+
+void*
+ecs_event_read(size_t channel_id, size_t *count)
+{
+    ecs_world *world;
+    ecs_event_channel *channel;
+
+    *count = 0;
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    channel = ecs_world_event_channel_get(world, channel_id);
+    if(!channel)
+    {
+        return(0);
+    }
+
+    return(ecs_event_channel_read(channel, count));
+}
+
+size_t
+ecs_spatial_index_create(
+    size_t component_id,
+    size_t offset,
+    size_t dimensions,
+    float cell_size)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_spatial_index_create(world, component_id, offset, dimensions, cell_size));
+}
+
+void
+ecs_spatial_index_destroy(size_t index_id)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    ecs_world_spatial_index_destroy(world, index_id);
+}
+
+size_t*
+ecs_spatial_query_radius(
+    size_t index_id,
+    float x, float y, float z,
+    float radius,
+    size_t *count)
+{
+    ecs_world *world;
+    ecs_spatial_index *index;
+    float center[3], min[3], max[3];
+    size_t i;
+
+    *count = 0;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    index = ecs_world_spatial_index_get(world, index_id);
+    if(!index)
+    {
+        return(0);
+    }
+
+    center[0] = x;
+    center[1] = y;
+    center[2] = z;
+    for(i = 0;
+        i < 3;
+        ++i)
+    {
+        min[i] = center[i] - radius;
+        max[i] = center[i] + radius;
+    }
+
+    return(ecs_spatial_index_query(index, min, max, center, radius, count));
+}
+
+size_t*
+ecs_spatial_query_aabb(
+    size_t index_id,
+    float min_x, float min_y, float min_z,
+    float max_x, float max_y, float max_z,
+    size_t *count)
+{
+    ecs_world *world;
+    ecs_spatial_index *index;
+    float min[3], max[3];
+
+    *count = 0;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    index = ecs_world_spatial_index_get(world, index_id);
+    if(!index)
+    {
+        return(0);
+    }
+
+    min[0] = min_x;
+    min[1] = min_y;
+    min[2] = min_z;
+    max[0] = max_x;
+    max[1] = max_y;
+    max[2] = max_z;
+
+    return(ecs_spatial_index_query(index, min, max, 0, 0.0f, count));
+}
+
+size_t
+ecs_key_index_create(
+    size_t component_id,
+    size_t offset,
+    size_t key_size,
+    int unique)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_key_index_create(world, component_id, offset, key_size, unique));
+}
+
+void
+ecs_key_index_destroy(size_t index_id)
+{
+    ecs_world *world;
 
-        ecs_entity_manager_destroy(&world->entity_manager, entity->id);
-        ecs_component_manager_entity_destroyed(&world->component_manager, entity->id);
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
     }
 
-    da_free(world->entity_manager.entities);
-    da_free(world->entity_manager.free_slots);
+    ecs_world_key_index_destroy(world, index_id);
+}
 
-    world->entity_manager.current_id = 0;
-    world->entity_manager.cap = 0;
-    world->entity_manager.entities = 0;
-    world->entity_manager.free_slots = 0;
+/* Last writer of the key on a unique index, first holder otherwise, 0 if
+   there is none */
+size_t
+ecs_key_index_find(size_t index_id, const void *key)
+{
+    ecs_world *world;
+    ecs_key_index *index;
 
-    ecs_map_free(&world->entity_manager.id_to_index);
-    ecs_map_free(&world->entity_manager.index_to_id);
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    index = ecs_world_key_index_get(world, index_id);
+    if(!index)
+    {
+        return(0);
+    }
+
+    return(ecs_key_index_holder(index, (unsigned char *)key, ecs_key_hash((unsigned char *)key, index->key_size)));
+}
+
+size_t*
+ecs_key_index_find_all(size_t index_id, const void *key, size_t *count)
+{
+    ecs_world *world;
+    ecs_key_index *index;
+
+    *count = 0;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    index = ecs_world_key_index_get(world, index_id);
+    if(!index)
+    {
+        return(0);
+    }
+
+    return(ecs_key_index_lookup(index, (void *)key, count));
+}
+
+void
+ecs_component_sort(size_t component_id, ecs_compare_function compare)
+{
+    ecs_world *world;
+    ecs_component_list *list;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return;
+    }
+
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!list)
+    {
+        return;
+    }
+
+    ecs_component_list_sort(list, compare);
+}
+
+size_t
+ecs_component_count(size_t component_id)
+{
+    ecs_world *world;
+    ecs_component_list *list;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!list)
+    {
+        return(0);
+    }
+
+    return(list->count);
+}
+
+void*
+ecs_component_data(size_t component_id)
+{
+    ecs_world *world;
+    ecs_component_list *list;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!list)
+    {
+        return(0);
+    }
+
+    return(list->data);
+}
+
+int
+ecs_journal_open(const char *path)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_journal_open(world, path));
+}
+
+int
+ecs_journal_flush(void)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_journal_flush(world));
+}
+
+int
+ecs_journal_close(void)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    return(ecs_world_journal_close(world));
+}
+
+int
+ecs_journal_snapshot(const char *path)
+{
+    ecs_world *world;
+    FILE *file;
+    int ok;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    file = fopen(path, "wb");
+    if(!file)
+    {
+        return(0);
+    }
+
+    ok = ecs_world_journal_snapshot(world, file);
+    if(fclose(file) != 0)
+    {
+        ok = 0;
+    }
+
+    return(ok);
+}
+
+int
+ecs_journal_replay(const char *path)
+{
+    ecs_world *world;
+    FILE *file;
+    int ok;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    file = fopen(path, "rb");
+    if(!file)
+    {
+        return(0);
+    }
+
+    ok = ecs_world_journal_replay(world, file);
+    fclose(file);
+
+    return(ok);
+}
+
+int
+ecs_component_double_buffer(size_t component_id)
+{
+    ecs_world *world;
+    ecs_component_list *list;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!list)
+    {
+        return(0);
+    }
+
+    return(ecs_component_list_buffer(list));
+}
+
+int
+ecs_component_double_buffer_refresh(size_t component_id)
+{
+    ecs_world *world;
+    ecs_component_list *list;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!list || !ecs_component_list_buffer(list))
+    {
+        return(0);
+    }
+
+    list->refresh = 1;
+
+    return(1);
+}
+
+void*
+ecs_entity_component_get_prev(size_t entity_id, size_t component_id)
+{
+    ecs_world *world;
+    ecs_component_list *list;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!list)
+    {
+        return(0);
+    }
+
+    return(ecs_component_list_get_prev(list, entity_id));
+}
+
+void*
+ecs_component_data_prev(size_t component_id)
+{
+    ecs_world *world;
+    ecs_component_list *list;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!list || !list->buffered)
+    {
+        return(0);
+    }
+
+    return(list->data_prev);
+}
+
+size_t
+ecs_component_memory(size_t component_id)
+{
+    ecs_world *world;
+    ecs_component_list *list;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
+
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!list)
+    {
+        return(0);
+    }
+
+    return(ecs_component_list_memory(list));
+}
+
+size_t*
+ecs_component_entities(size_t component_id)
+{
+    ecs_world *world;
+    ecs_component_list *list;
 
-    for(component_index = 0;
-        component_index < world->component_manager.cap;
-        ++component_index)
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
     {
-        ecs_component_list *list;
-
-        list = &(world->component_manager.lists[component_index]);
-        if(list->destroyed)
-        {
-            continue;
-        }
+        return(0);
+    }
 
-        ecs_component_manager_unregister(&world->component_manager, list->id);
+    list = ecs_component_manager_get_list(&world->component_manager, component_id);
+    if(!list)
+    {
+        return(0);
     }
 
-    da_free(world->component_manager.lists);
-    da_free(world->component_manager.free_slots);
+    return(list->entities);
+}
 
-    world->component_manager.current_id = 0;
-    world->component_manager.cap = 0;
-    world->component_manager.lists = 0;
-    world->component_manager.free_slots = 0;
+size_t
+ecs_prefab_create(void)
+{
+    ecs_world *world;
 
-    ecs_map_free(&world->component_manager.id_to_index);
-    ecs_map_free(&world->component_manager.index_to_id);
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
 
-    da_free(world->query_result.list);
-    world->query_result.list = 0;
-    world->query_result.count = 0;
+    return(ecs_world_prefab_create(world));
 }
 
-ecs_world *
-ecs_world_manager_get_at(
-    ecs_world_manager *world_manager,
-    size_t world_index)
+void
+ecs_prefab_destroy(size_t prefab_id)
 {
-    if(world_index >= world_manager->cap)
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
     {
-        return(0);
+        return;
     }
 
-    return(&(world_manager->worlds[world_index]));
+    ecs_world_prefab_destroy(world, prefab_id);
 }
 
-ecs_world *
-ecs_world_manager_get(
-    ecs_world_manager *world_manager,
-    size_t world_id)
+void*
+ecs_prefab_component_attach(size_t prefab_id, size_t component_id)
 {
-    size_t *world_index_ptr, world_index;
+    ecs_world *world;
 
-    world_index_ptr = ecs_map_get(&world_manager->id_to_index, world_id);
-    if(!world_index_ptr)
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
     {
         return(0);
     }
 
-    world_index = *world_index_ptr;
-
-    return(ecs_world_manager_get_at(world_manager, world_index));
+    return(ecs_world_prefab_component_attach(world, prefab_id, component_id));
 }
 
-typedef struct
-ecs
+void*
+ecs_prefab_component_get(size_t prefab_id, size_t component_id)
 {
-    ecs_world_manager world_manager;
-    size_t current_world_id;
-} ecs;
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
 
-ecs ecs_instance = {0};
+    return(ecs_world_prefab_component_get(world, prefab_id, component_id));
+}
 
 size_t
-ecs_world_create(void)
+ecs_entity_instantiate(size_t prefab_id, size_t count)
 {
-    size_t world_id, world_index;
-    ecs_world world = {0};
-
-    /* TODO: Check index in free_slots first */
+    ecs_world *world;
 
-    world_id = ++ecs_instance.world_manager.current_id;
-    world_index = da_len(ecs_instance.world_manager.worlds);
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
 
-    da_push(ecs_instance.world_manager.worlds, world);
+    return(ecs_world_entity_instantiate(world, prefab_id, count));
+}
 
-    ecs_map_set(&ecs_instance.world_manager.id_to_index, world_id, world_index);
-    ecs_map_set(&ecs_instance.world_manager.index_to_id, world_index, world_id);
+size_t
+ecs_observer_register(
+    size_t component_id,
+    int event,
+    ecs_observer_function callback,
+    void *user_data)
+{
+    ecs_world *world;
 
-    ecs_instance.world_manager.cap += 1;
-    ecs_instance.current_world_id = world_id;
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
+    {
+        return(0);
+    }
 
-    return(world_id);
+    return(ecs_world_observer_register(world, component_id, event, callback, user_data));
 }
 
 void
-ecs_world_destroy(size_t world_id)
+ecs_observer_unregister(size_t observer_id)
 {
-    size_t *world_index_ptr, world_index;
     ecs_world *world;
 
-    world_index_ptr = ecs_map_get(&ecs_instance.world_manager.id_to_index, world_id);
-    if(!world_index_ptr)
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
     {
         return;
     }
 
-    world_index = *world_index_ptr;
-
-    world = &(ecs_instance.world_manager.worlds[world_index]);
-    world->dead = 1;
+    ecs_world_observer_unregister(world, observer_id);
 }
 
 void
-ecs_world_current_set(size_t world_id)
-{
-    ecs_instance.current_world_id = world_id;
-}
-
-size_t
-ecs_world_current_get(void)
-{
-    return(ecs_instance.current_world_id);
-}
-
-ecs_query_result*
-ecs_query(size_t num_components, ...)
+ecs_observers_flush(void)
 {
-    ecs_query_result *result;
     ecs_world *world;
-    va_list args;
 
     world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
-    if(!world || world->dead)
+    if(!world)
     {
-        return(0);
+        return;
     }
 
-    va_start(args, num_components);
-    result = ecs_world_query(world, num_components, args);
-    va_end(args);
-
-    return(result);
+    ecs_world_observers_flush(world);
 }
 
 size_t
-ecs_entity_create(void)
+ecs_system_register(
+    int phase,
+    ecs_system_function function,
+    float frequency,
+    void *user_data)
 {
-    size_t entity_id;
     ecs_world *world;
 
     world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
@@ -1125,16 +8244,13 @@ ecs_entity_create(void)
         return(0);
     }
 
-    entity_id = ecs_entity_manager_create(&world->entity_manager);
-
-    return(entity_id);
+    return(ecs_world_system_register(world, phase, function, frequency, user_data));
 }
 
 void
-ecs_entity_destroy(size_t entity_id)
+ecs_system_unregister(size_t system_id)
 {
     ecs_world *world;
-    ecs_entity *entity;
 
     world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
     if(!world)
@@ -1142,19 +8258,26 @@ ecs_entity_destroy(size_t entity_id)
         return;
     }
 
-    entity = ecs_entity_manager_get(&world->entity_manager, entity_id);
-    if(!entity)
+    ecs_world_system_unregister(world, system_id);
+}
+
+int
+ecs_system_component_access(size_t system_id, size_t component_id, int access)
+{
+    ecs_world *world;
+
+    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
+    if(!world)
     {
-        return;
+        return(0);
     }
 
-    entity->dead = 1;
+    return(ecs_world_system_component_access(world, system_id, component_id, access));
 }
 
-size_t
-ecs_component_register(size_t component_size)
+int
+ecs_system_resource_access(size_t system_id, size_t resource_id, int access)
 {
-    size_t component_id;
     ecs_world *world;
 
     world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
@@ -1163,27 +8286,34 @@ ecs_component_register(size_t component_size)
         return(0);
     }
 
-    component_id = ecs_component_manager_register(&world->component_manager, component_size);
-
-    return(component_id);
+    return(ecs_world_system_resource_access(world, system_id, resource_id, access));
 }
 
-void
-ecs_component_unregister(size_t component_id)
+/* 1 when the two systems may not share a batch, also for unknown ids */
+int
+ecs_system_conflicts(size_t system_id, size_t other_id)
 {
     ecs_world *world;
+    ecs_system *system, *other;
 
     world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
     if(!world)
     {
-        return;
+        return(1);
     }
 
-    ecs_component_manager_unregister(&world->component_manager, component_id);
+    system = ecs_world_system_get(world, system_id);
+    other = ecs_world_system_get(world, other_id);
+    if(!system || !other)
+    {
+        return(1);
+    }
+
+    return(ecs_system_conflict(system, other));
 }
 
 void
-ecs_entity_component_attach(size_t entity_id, size_t component_id)
+ecs_fixed_step_set(float step)
 {
     ecs_world *world;
 
@@ -1193,25 +8323,159 @@ ecs_entity_component_attach(size_t entity_id, size_t component_id)
         return;
     }
 
-    ecs_world_entity_component_attach(world, entity_id, component_id);
+    ecs_world_fixed_step_set(world, step);
+}
+
+/* Systems can create worlds, switch the current one and register systems,
+   so the world and its systems are looked up again around every call.
+   Declared systems in a row that do not conflict run as one batch. */
+int
+ecs_pipeline_phase_run(size_t world_id, int phase, float dt)
+{
+    ecs_world *world;
+    ecs_system_job *jobs;
+    size_t i, j, first, jobs_count, systems_count;
+
+    i = 0;
+    for(;;)
+    {
+        ecs_system *system;
+        float elapsed;
+
+        world = ecs_world_manager_get(&ecs_instance.world_manager, world_id);
+        if(!world || world->dead)
+        {
+            return(0);
+        }
+
+        systems_count = da_len(world->systems);
+        if(i >= systems_count)
+        {
+            break;
+        }
+
+        system = &(world->systems[i++]);
+        if(system->destroyed || system->phase != phase || !ecs_system_due(system, dt, &elapsed))
+        {
+            continue;
+        }
+
+        ecs_instance.current_world_id = world_id;
+        jobs = system->declared ? (ecs_system_job *)ecs_arena_push(&world->arena, (systems_count - i + 1)*sizeof(ecs_system_job)) : 0;
+        if(!jobs)
+        {
+            system->function(elapsed, system->user_data);
+            continue;
+        }
+
+        /* Grow the batch until an undeclared or conflicting system */
+        first = i - 1;
+        jobs[0].function = system->function;
+        jobs[0].user_data = system->user_data;
+        jobs[0].elapsed = elapsed;
+        jobs_count = 1;
+        for(;
+            i < systems_count;
+            ++i)
+        {
+            ecs_system *next;
+
+            next = &(world->systems[i]);
+            if(next->destroyed || next->phase != phase)
+            {
+                continue;
+            }
+
+            for(j = first;
+                j < i;
+                ++j)
+            {
+                if(!world->systems[j].destroyed && world->systems[j].phase == phase &&
+                   ecs_system_conflict(&(world->systems[j]), next))
+                {
+                    break;
+                }
+            }
+
+            if(!next->declared || j < i)
+            {
+                break;
+            }
+
+            if(ecs_system_due(next, dt, &elapsed))
+            {
+                jobs[jobs_count].function = next->function;
+                jobs[jobs_count].user_data = next->user_data;
+                jobs[jobs_count].elapsed = elapsed;
+                jobs_count += 1;
+            }
+        }
+
+        ecs_parallel_for(jobs_count, ecs_system_job_run, jobs);
+    }
+
+    /* Sync point before the next phase */
+    ecs_world_sync(world);
+
+    return(1);
 }
 
 void
-ecs_entity_component_detach(size_t entity_id, size_t component_id)
+ecs_progress(float dt)
 {
     ecs_world *world;
+    size_t world_id, steps;
+    float step;
+    int running;
 
-    world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
-    if(!world)
+    world_id = ecs_instance.current_world_id;
+    if(!ecs_world_manager_get(&ecs_instance.world_manager, world_id))
     {
         return;
     }
 
-    ecs_world_entity_component_detach(world, entity_id, component_id);
+    if(!(dt > 0.0f))
+    {
+        dt = 0.0f;
+    }
+
+    running = ecs_pipeline_phase_run(world_id, ECS_PHASE_PRE_UPDATE, dt);
+
+    /* Whole fixed steps only, the remainder carries over to the next frame */
+    world = ecs_world_manager_get(&ecs_instance.world_manager, world_id);
+    if(world && running)
+    {
+        step = (world->fixed_step > 0.0f) ? world->fixed_step : ECS_FIXED_STEP_DEFAULT;
+        world->fixed_accumulator += dt;
+        for(steps = 0;
+            running && world && world->fixed_accumulator >= step;
+            ++steps)
+        {
+            /* Too far behind to catch up, drop the backlog instead of spiralling */
+            if(steps == ECS_FIXED_STEPS_MAX)
+            {
+                world->fixed_accumulator = 0.0f;
+                break;
+            }
+
+            world->fixed_accumulator -= step;
+            running = ecs_pipeline_phase_run(world_id, ECS_PHASE_FIXED, step);
+            world = ecs_world_manager_get(&ecs_instance.world_manager, world_id);
+        }
+    }
+
+    if(running && ecs_pipeline_phase_run(world_id, ECS_PHASE_UPDATE, dt))
+    {
+        ecs_pipeline_phase_run(world_id, ECS_PHASE_POST_UPDATE, dt);
+    }
+
+    /* A world destroyed by a system is reclaimed here as well */
+    ecs_instance.current_world_id = world_id;
+    ecs_update();
 }
 
-void*
-ecs_entity_component_get(size_t entity_id, size_t component_id)
+int
+ecs_entity_component_modified(size_t entity_id, size_t component_id)
 {
     ecs_world *world;
 
@@ -1221,14 +8485,14 @@ ecs_entity_component_get(size_t entity_id, size_t component_id)
         return(0);
     }
 
-    return(ecs_world_entity_component_get(world, entity_id, component_id));
+    return(ecs_world_entity_component_modified(world, entity_id, component_id));
 }
 
 void
 ecs_update(void)
 {
     ecs_world *world;
-    size_t entity_index, world_index;
+    size_t component_index, channel_index, world_index;
 
     world = ecs_world_manager_get(&ecs_instance.world_manager, ecs_instance.current_world_id);
     if(!world)
@@ -1236,24 +8500,37 @@ ecs_update(void)
         return;
     }
 
-    for(entity_index = 0;
-        entity_index < world->entity_manager.cap;
-        ++entity_index)
-    {
-        ecs_entity *entity;
+    ecs_world_sync(world);
+    ecs_arena_reset(&world->arena);
+    ecs_slab_flush(&world->slab);
 
-        entity = &(world->entity_manager.entities[entity_index]);
-        if(!entity)
+    for(component_index = 0;
+        component_index < da_len(world->component_manager.lists);
+        ++component_index)
+    {
+        if(!world->component_manager.lists[component_index].destroyed)
         {
-            continue;
+            ecs_component_list_swap(&(world->component_manager.lists[component_index]));
         }
+    }
 
-        if(entity->dead && !entity->destroyed)
+    /* Events last one frame */
+    for(channel_index = 0;
+        channel_index < da_len(world->event_channels);
+        ++channel_index)
+    {
+        if(!world->event_channels[channel_index].destroyed)
         {
-            ecs_world_entity_destroy(world, entity->id);
+            ecs_event_channel_clear(&(world->event_channels[channel_index]));
         }
     }
 
+    /* One batch of journal writes per update */
+    if(world->journal)
+    {
+        ecs_world_journal_flush(world);
+    }
+
     for(world_index = 0;
         world_index < ecs_instance.world_manager.cap;
         ++world_index)
@@ -0,0 +1,271 @@
+#ifndef ECS_HPP
+#define ECS_HPP
+
+/*
+ * Type-safe C++17 front-end for ecs.h.
+ *
+ * The component set is part of the world type, so every component id is a
+ * compile-time constant (its position in the list, starting at 1) and
+ * each<...>() expands into a loop specialized for the requested types.
+ *
+ * The C implementation still has to be compiled once, in a C or C++ file
+ * that defines ECS_IMPLEMENTATION before including ecs.h.
+ */
+
+#include <cassert>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "ecs.h"
+
+namespace ecs
+{
+
+namespace detail
+{
+
+template<typename T, typename... Ts>
+struct index_of;
+
+template<typename T, typename... Ts>
+struct index_of<T, T, Ts...> : std::integral_constant<std::size_t, 0>
+{
+};
+
+template<typename T, typename U, typename... Ts>
+struct index_of<T, U, Ts...> : std::integral_constant<std::size_t, 1 + index_of<T, Ts...>::value>
+{
+};
+
+} /* namespace detail */
+
+using entity = std::size_t;
+
+template<typename... Components>
+class world
+{
+    static_assert(sizeof...(Components) > 0, "a world needs at least one component type");
+    static_assert((std::is_trivially_copyable_v<Components> && ...),
+                  "components are copied and zeroed as raw bytes");
+
+public:
+    template<typename T>
+    static constexpr std::size_t component_id = detail::index_of<T, Components...>::value + 1;
+
+    world()
+    {
+        handle_ = ecs_world_create();
+        (register_component<Components>(), ...);
+    }
+
+    ~world()
+    {
+        ecs_world_destroy(handle_);
+    }
+
+    world(const world &) = delete;
+    world &operator=(const world &) = delete;
+
+    std::size_t handle() const
+    {
+        return handle_;
+    }
+
+    entity create()
+    {
+        bind();
+        return ecs_entity_create();
+    }
+
+    void destroy(entity e)
+    {
+        bind();
+        ecs_entity_destroy(e);
+    }
+
+    template<typename T>
+    T *attach(entity e)
+    {
+        bind();
+        ecs_entity_component_attach(e, component_id<T>);
+        return fetch<T>(e);
+    }
+
+    template<typename T>
+    void detach(entity e)
+    {
+        bind();
+        ecs_entity_component_detach(e, component_id<T>);
+    }
+
+    template<typename T>
+    bool has(entity e)
+    {
+        bind();
+        return ecs_entity_component_has(e, component_id<T>) != 0;
+    }
+
+    template<typename T>
+    T *get(entity e)
+    {
+        bind();
+        return fetch<T>(e);
+    }
+
+    /* Value as of the last update, for components made double-buffered */
+    template<typename T>
+    const T *previous(entity e)
+    {
+        static_assert(!std::is_empty_v<T>, "a tag has no previous value");
+
+        bind();
+        return static_cast<const T *>(ecs_entity_component_get_prev(e, component_id<T>));
+    }
+
+    template<typename T>
+    bool double_buffer()
+    {
+        static_assert(!std::is_empty_v<T>, "a tag has no column to buffer");
+
+        bind();
+        return ecs_component_double_buffer(component_id<T>) != 0;
+    }
+
+    /* Also copies the read column back after each swap, for partial writers */
+    template<typename T>
+    bool double_buffer_refresh()
+    {
+        static_assert(!std::is_empty_v<T>, "a tag has no column to buffer");
+
+        bind();
+        return ecs_component_double_buffer_refresh(component_id<T>) != 0;
+    }
+
+    void update()
+    {
+        bind();
+        ecs_update();
+    }
+
+    /* Runs the systems registered with ecs_system_register, then update() */
+    void progress(float dt)
+    {
+        bind();
+        ecs_progress(dt);
+    }
+
+    /* Disabled entities and components keep their data but each skips them */
+    void enable(entity e, bool on)
+    {
+        bind();
+        ecs_entity_enable(e, on ? 1 : 0);
+    }
+
+    template<typename T>
+    void enable(entity e, bool on)
+    {
+        bind();
+        ecs_entity_component_enable(e, component_id<T>, on ? 1 : 0);
+    }
+
+    /*
+     * Calls f(First &, Rest &...) or f(entity, First &, Rest &...) for every
+     * live entity that has all the requested components enabled. The column
+     * of First drives the loop, so put the rarest component first. Empty
+     * types are tags and have no column, so First must be a type with data.
+     * Rows are resolved before the first call, so f must not attach, detach
+     * or destroy.
+     */
+    template<typename First, typename... Rest, typename F>
+    void each(F &&f)
+    {
+        static_assert(!std::is_empty_v<First>, "a tag has no column to drive the loop");
+
+        bind();
+
+        /* One pass in C resolves the lists and the Rest rows of every match */
+        constexpr std::size_t width = 1 + sizeof...(Rest);
+        const std::size_t ids[width] = {component_id<First>, component_id<Rest>...};
+        std::size_t count = 0;
+        const std::size_t *rows = ecs_component_rows(ids, width, &count);
+
+        First *column = static_cast<First *>(ecs_component_data(component_id<First>));
+        const std::size_t *entities = ecs_component_entities(component_id<First>);
+        const std::tuple<Rest *...> columns{column_of<Rest>()...};
+
+        for(std::size_t i = 0; i < count; ++i)
+        {
+            const std::size_t *row = rows + i * width;
+            invoke<First, Rest...>(f, entities[row[0]], column[row[0]], columns, row,
+                                   std::index_sequence_for<Rest...>{});
+        }
+    }
+
+private:
+    /* Tags are never written, every entity that has one shares this instance */
+    template<typename T>
+    static inline T tag_instance{};
+
+    template<typename T>
+    T *fetch(entity e)
+    {
+        if constexpr(std::is_empty_v<T>)
+        {
+            return ecs_entity_component_has(e, component_id<T>) ? &tag_instance<T> : nullptr;
+        }
+        else
+        {
+            return static_cast<T *>(ecs_entity_component_get(e, component_id<T>));
+        }
+    }
+
+    /* Tags are at row 0 of a one-element column */
+    template<typename T>
+    T *column_of()
+    {
+        if constexpr(std::is_empty_v<T>)
+        {
+            return &tag_instance<T>;
+        }
+        else
+        {
+            return static_cast<T *>(ecs_component_data(component_id<T>));
+        }
+    }
+
+    template<typename T>
+    void register_component()
+    {
+        /* Empty types are registered as tags */
+        const std::size_t id = ecs_component_register(std::is_empty_v<T> ? 0 : sizeof(T));
+        assert(id == component_id<T>);
+        (void)id;
+    }
+
+    template<typename First, typename... Rest, typename F, std::size_t... I>
+    static void invoke(F &f, entity e, First &first, const std::tuple<Rest *...> &columns,
+                       const std::size_t *row, std::index_sequence<I...>)
+    {
+        if constexpr(std::is_invocable_v<F &, entity, First &, Rest &...>)
+        {
+            f(e, first, std::get<I>(columns)[row[I + 1]]...);
+        }
+        else
+        {
+            f(first, std::get<I>(columns)[row[I + 1]]...);
+        }
+    }
+
+    void bind()
+    {
+        ecs_world_current_set(handle_);
+    }
+
+    std::size_t handle_;
+};
+
+} /* namespace ecs */
+
+#endif
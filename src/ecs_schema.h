@@ -0,0 +1,429 @@
+/*
+ * Schema mode: a world generated at compile time for a fixed component set.
+ *
+ *     #define ECS_SCHEMA_NAME game
+ *     #define ECS_SCHEMA(X) \
+ *         X(position, vec3) \
+ *         X(velocity, vec3)
+ *     #include "ecs_schema.h"
+ *
+ * gives a game_world struct with one typed column per component, constant
+ * component ids (game_position_id, starting at 1) and a mask of constant
+ * width (game_mask_words words per entity). Every lookup is an array index,
+ * there is no registration and no map:
+ *
+ *     game_world       world = {0};
+ *     size_t           game_entity_create(game_world *world);
+ *     void             game_entity_destroy(game_world *world, size_t entity_id);
+ *     int              game_entity_has(game_world *world, size_t entity_id, size_t component_id);
+ *     vec3            *game_position_attach(game_world *world, size_t entity_id);
+ *     void             game_position_detach(game_world *world, size_t entity_id);
+ *     vec3            *game_position_get(game_world *world, size_t entity_id);
+ *     size_t          *game_query(game_world *world, const size_t *mask, size_t *count);
+ *     void             game_world_free(game_world *world);
+ *
+ * Columns are packed, world.columns.position.data holds
+ * world.columns.position.count rows and world.columns.position.entities the
+ * entity of each row. A schema world stands on its own: observers, indices,
+ * the journal and ecs_update do not apply to it, and ids of destroyed
+ * entities are reused. Create and attach return 0 when an allocation fails
+ * and leave the world as it was.
+ *
+ * The header can be included again with another ECS_SCHEMA_NAME. Functions
+ * are defined in the file that defines ECS_IMPLEMENTATION.
+ */
+
+#include "ecs.h"
+
+#ifndef ECS_SCHEMA_H
+#define ECS_SCHEMA_H
+
+#define ECS_SCHEMA_BITS (sizeof(size_t)*8)
+
+#define ecs_schema_mask_set(mask, component_id) \
+    ((mask)[((component_id) - 1) / ECS_SCHEMA_BITS] |= (size_t)1 << (((component_id) - 1) % ECS_SCHEMA_BITS))
+#define ecs_schema_mask_test(mask, component_id) \
+    (((mask)[((component_id) - 1) / ECS_SCHEMA_BITS] >> (((component_id) - 1) % ECS_SCHEMA_BITS)) & 1)
+#define ecs_schema_mask_clear(mask, component_id) \
+    ((mask)[((component_id) - 1) / ECS_SCHEMA_BITS] &= ~((size_t)1 << (((component_id) - 1) % ECS_SCHEMA_BITS)))
+
+#define ECS_SCHEMA_CAT_(a, b) a##b
+#define ECS_SCHEMA_CAT(a, b) ECS_SCHEMA_CAT_(a, b)
+#define ECS_SCHEMA_SYM(suffix) ECS_SCHEMA_CAT(ECS_SCHEMA_NAME, suffix)
+
+#endif
+
+#if !defined(ECS_SCHEMA_NAME) || !defined(ECS_SCHEMA)
+#error "define ECS_SCHEMA_NAME and ECS_SCHEMA(X) before including ecs_schema.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ECS_SCHEMA_WORLD ECS_SCHEMA_SYM(_world)
+#define ECS_SCHEMA_ENTITY ECS_SCHEMA_SYM(_entity)
+#define ECS_SCHEMA_MASK_WORDS ECS_SCHEMA_SYM(_mask_words)
+
+#define ECS_SCHEMA_ID(name, type) ECS_SCHEMA_SYM(_##name##_id),
+#define ECS_SCHEMA_COLUMN(name, type) \
+    struct \
+    { \
+        type *data; \
+        size_t *entities; /* Entity of each row */ \
+        size_t *rows;     /* Row + 1 of each entity slot, 0 when absent */ \
+        size_t count; \
+        size_t cap; \
+    } name;
+#define ECS_SCHEMA_DECLARE(name, type) \
+    type *ECS_SCHEMA_SYM(_##name##_attach)(ECS_SCHEMA_WORLD *world, size_t entity_id); \
+    void  ECS_SCHEMA_SYM(_##name##_detach)(ECS_SCHEMA_WORLD *world, size_t entity_id); \
+    type *ECS_SCHEMA_SYM(_##name##_get)(ECS_SCHEMA_WORLD *world, size_t entity_id);
+
+/* Ids start at 1 like registered components, bit id - 1 of the mask */
+enum
+{
+    ECS_SCHEMA_SYM(_component_none) = 0,
+    ECS_SCHEMA(ECS_SCHEMA_ID)
+    ECS_SCHEMA_SYM(_component_end),
+    ECS_SCHEMA_MASK_WORDS = (ECS_SCHEMA_SYM(_component_end) - 1 + ECS_SCHEMA_BITS - 1) / ECS_SCHEMA_BITS
+};
+
+typedef struct
+ECS_SCHEMA_ENTITY
+{
+    size_t mask[ECS_SCHEMA_MASK_WORDS];
+    int alive;
+} ECS_SCHEMA_ENTITY;
+
+typedef struct
+ECS_SCHEMA_WORLD
+{
+    ECS_SCHEMA_ENTITY *entities; /* Entity id is index + 1 */
+    size_t count;
+    size_t cap;
+
+    size_t *free_ids;
+    size_t free_count;
+
+    /* Entities returned by the last query */
+    size_t *matches;
+    size_t matches_cap;
+
+    struct
+    {
+        ECS_SCHEMA(ECS_SCHEMA_COLUMN)
+    } columns;
+} ECS_SCHEMA_WORLD;
+
+size_t  ECS_SCHEMA_SYM(_entity_create)(ECS_SCHEMA_WORLD *world);
+void    ECS_SCHEMA_SYM(_entity_destroy)(ECS_SCHEMA_WORLD *world, size_t entity_id);
+int     ECS_SCHEMA_SYM(_entity_alive)(ECS_SCHEMA_WORLD *world, size_t entity_id);
+int     ECS_SCHEMA_SYM(_entity_has)(ECS_SCHEMA_WORLD *world, size_t entity_id, size_t component_id);
+
+ECS_SCHEMA(ECS_SCHEMA_DECLARE)
+
+/* Entities that have every component set in mask, valid until the next query */
+size_t *ECS_SCHEMA_SYM(_query)(ECS_SCHEMA_WORLD *world, const size_t *mask, size_t *count);
+void    ECS_SCHEMA_SYM(_world_free)(ECS_SCHEMA_WORLD *world);
+
+#ifdef ECS_IMPLEMENTATION
+
+/* Slots from world->cap on are zeroed, again on a retry after a failure */
+#define ECS_SCHEMA_ROWS_GROW(name, type) \
+    rows = (size_t *)ecs_realloc(world->columns.name.rows, cap*sizeof(size_t)); \
+    if(!rows) \
+    { \
+        return(0); \
+    } \
+    ecs_mem_zero(rows + world->cap, (cap - world->cap)*sizeof(size_t)); \
+    world->columns.name.rows = rows;
+
+#define ECS_SCHEMA_DETACH_ALL(name, type) \
+    ECS_SCHEMA_SYM(_##name##_detach)(world, entity_id);
+
+#define ECS_SCHEMA_FREE(name, type) \
+    ecs_free(world->columns.name.data); \
+    ecs_free(world->columns.name.entities); \
+    ecs_free(world->columns.name.rows);
+
+/* The smallest required column drives the query */
+#define ECS_SCHEMA_DRIVER(name, type) \
+    if(ecs_schema_mask_test(mask, ECS_SCHEMA_SYM(_##name##_id)) && world->columns.name.count < driver_count) \
+    { \
+        driver = world->columns.name.entities; \
+        driver_count = world->columns.name.count; \
+    }
+
+#define ECS_SCHEMA_DEFINE(name, type) \
+    type* \
+    ECS_SCHEMA_SYM(_##name##_get)(ECS_SCHEMA_WORLD *world, size_t entity_id) \
+    { \
+        size_t row; \
+        \
+        if(entity_id == 0 || entity_id > world->count) \
+        { \
+            return(0); \
+        } \
+        \
+        row = world->columns.name.rows[entity_id - 1]; \
+        if(!row) \
+        { \
+            return(0); \
+        } \
+        \
+        return(&(world->columns.name.data[row - 1])); \
+    } \
+    \
+    type* \
+    ECS_SCHEMA_SYM(_##name##_attach)(ECS_SCHEMA_WORLD *world, size_t entity_id) \
+    { \
+        type *data; \
+        size_t row; \
+        \
+        if(!ECS_SCHEMA_SYM(_entity_alive)(world, entity_id)) \
+        { \
+            return(0); \
+        } \
+        \
+        data = ECS_SCHEMA_SYM(_##name##_get)(world, entity_id); \
+        if(data) \
+        { \
+            return(data); \
+        } \
+        \
+        if(world->columns.name.count == world->columns.name.cap) \
+        { \
+            size_t cap, *entities; \
+            \
+            cap = world->columns.name.cap ? world->columns.name.cap*2 : 16; \
+            data = (type *)ecs_realloc(world->columns.name.data, cap*sizeof(type)); \
+            if(!data) \
+            { \
+                return(0); \
+            } \
+            world->columns.name.data = data; \
+            \
+            entities = (size_t *)ecs_realloc(world->columns.name.entities, cap*sizeof(size_t)); \
+            if(!entities) \
+            { \
+                return(0); \
+            } \
+            world->columns.name.entities = entities; \
+            world->columns.name.cap = cap; \
+        } \
+        \
+        row = world->columns.name.count++; \
+        world->columns.name.entities[row] = entity_id; \
+        world->columns.name.rows[entity_id - 1] = row + 1; \
+        ecs_schema_mask_set(world->entities[entity_id - 1].mask, ECS_SCHEMA_SYM(_##name##_id)); \
+        \
+        data = &(world->columns.name.data[row]); \
+        ecs_mem_zero(data, sizeof(type)); \
+        \
+        return(data); \
+    } \
+    \
+    /* The last row takes the place of the removed one */ \
+    void \
+    ECS_SCHEMA_SYM(_##name##_detach)(ECS_SCHEMA_WORLD *world, size_t entity_id) \
+    { \
+        size_t row, last; \
+        \
+        if(!ECS_SCHEMA_SYM(_##name##_get)(world, entity_id)) \
+        { \
+            return; \
+        } \
+        \
+        row = world->columns.name.rows[entity_id - 1] - 1; \
+        last = --world->columns.name.count; \
+        if(row != last) \
+        { \
+            world->columns.name.data[row] = world->columns.name.data[last]; \
+            world->columns.name.entities[row] = world->columns.name.entities[last]; \
+            world->columns.name.rows[world->columns.name.entities[row] - 1] = row + 1; \
+        } \
+        \
+        world->columns.name.rows[entity_id - 1] = 0; \
+        ecs_schema_mask_clear(world->entities[entity_id - 1].mask, ECS_SCHEMA_SYM(_##name##_id)); \
+    }
+
+ECS_SCHEMA(ECS_SCHEMA_DEFINE)
+
+int
+ECS_SCHEMA_SYM(_entity_alive)(ECS_SCHEMA_WORLD *world, size_t entity_id)
+{
+    return(entity_id != 0 && entity_id <= world->count && world->entities[entity_id - 1].alive);
+}
+
+int
+ECS_SCHEMA_SYM(_entity_has)(ECS_SCHEMA_WORLD *world, size_t entity_id, size_t component_id)
+{
+    if(!ECS_SCHEMA_SYM(_entity_alive)(world, entity_id) ||
+       component_id == 0 || component_id >= ECS_SCHEMA_SYM(_component_end))
+    {
+        return(0);
+    }
+
+    return((int)ecs_schema_mask_test(world->entities[entity_id - 1].mask, component_id));
+}
+
+size_t
+ECS_SCHEMA_SYM(_entity_create)(ECS_SCHEMA_WORLD *world)
+{
+    ECS_SCHEMA_ENTITY *entity;
+    size_t entity_id;
+
+    if(world->free_count)
+    {
+        entity_id = world->free_ids[--world->free_count];
+    }
+    else
+    {
+        if(world->count == world->cap)
+        {
+            ECS_SCHEMA_ENTITY *entities;
+            size_t cap, *rows, *free_ids;
+
+            /* Every array is grown before cap is committed. When one fails
+               the ones already grown keep their larger blocks, the world
+               still works at its old cap and the next create tries again. */
+            cap = world->cap ? world->cap*2 : 64;
+
+            entities = (ECS_SCHEMA_ENTITY *)ecs_realloc(world->entities, cap*sizeof(ECS_SCHEMA_ENTITY));
+            if(!entities)
+            {
+                return(0);
+            }
+            world->entities = entities;
+
+            free_ids = (size_t *)ecs_realloc(world->free_ids, cap*sizeof(size_t));
+            if(!free_ids)
+            {
+                return(0);
+            }
+            world->free_ids = free_ids;
+
+            /* Every column maps entity slots to rows */
+            ECS_SCHEMA(ECS_SCHEMA_ROWS_GROW)
+
+            world->cap = cap;
+        }
+
+        entity_id = ++world->count;
+    }
+
+    entity = &(world->entities[entity_id - 1]);
+    ecs_mem_zero(entity, sizeof(*entity));
+    entity->alive = 1;
+
+    return(entity_id);
+}
+
+void
+ECS_SCHEMA_SYM(_entity_destroy)(ECS_SCHEMA_WORLD *world, size_t entity_id)
+{
+    if(!ECS_SCHEMA_SYM(_entity_alive)(world, entity_id))
+    {
+        return;
+    }
+
+    ECS_SCHEMA(ECS_SCHEMA_DETACH_ALL)
+
+    world->entities[entity_id - 1].alive = 0;
+    world->free_ids[world->free_count++] = entity_id;
+}
+
+size_t*
+ECS_SCHEMA_SYM(_query)(ECS_SCHEMA_WORLD *world, const size_t *mask, size_t *count)
+{
+    size_t *driver, driver_count, i, w, found;
+
+    *count = 0;
+
+    driver = 0;
+    driver_count = world->count;
+    ECS_SCHEMA(ECS_SCHEMA_DRIVER)
+
+    if(driver_count > world->matches_cap)
+    {
+        size_t *matches;
+
+        matches = (size_t *)ecs_realloc(world->matches, driver_count*sizeof(size_t));
+        if(!matches)
+        {
+            return(0);
+        }
+
+        world->matches = matches;
+        world->matches_cap = driver_count;
+    }
+
+    found = 0;
+    for(i = 0;
+        i < driver_count;
+        ++i)
+    {
+        ECS_SCHEMA_ENTITY *entity;
+        size_t entity_id;
+
+        entity_id = driver ? driver[i] : i + 1;
+        entity = &(world->entities[entity_id - 1]);
+        if(!entity->alive)
+        {
+            continue;
+        }
+
+        /* The mask width is a constant, the compiler unrolls this */
+        for(w = 0;
+            w < ECS_SCHEMA_MASK_WORDS;
+            ++w)
+        {
+            if((entity->mask[w] & mask[w]) != mask[w])
+            {
+                break;
+            }
+        }
+
+        if(w == ECS_SCHEMA_MASK_WORDS)
+        {
+            world->matches[found++] = entity_id;
+        }
+    }
+
+    *count = found;
+
+    return(world->matches);
+}
+
+void
+ECS_SCHEMA_SYM(_world_free)(ECS_SCHEMA_WORLD *world)
+{
+    ECS_SCHEMA(ECS_SCHEMA_FREE)
+
+    ecs_free(world->entities);
+    ecs_free(world->free_ids);
+    ecs_free(world->matches);
+    ecs_mem_zero(world, sizeof(*world));
+}
+
+#undef ECS_SCHEMA_ROWS_GROW
+#undef ECS_SCHEMA_DETACH_ALL
+#undef ECS_SCHEMA_FREE
+#undef ECS_SCHEMA_DRIVER
+#undef ECS_SCHEMA_DEFINE
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#undef ECS_SCHEMA_ID
+#undef ECS_SCHEMA_COLUMN
+#undef ECS_SCHEMA_DECLARE
+#undef ECS_SCHEMA_WORLD
+#undef ECS_SCHEMA_ENTITY
+#undef ECS_SCHEMA_MASK_WORDS
+#undef ECS_SCHEMA_NAME
+#undef ECS_SCHEMA
@@ -0,0 +1,1458 @@
+/*
+ * Behavioural checks for ecs.h, see the Tests section of the README.
+ * Every test runs in a world of its own and returns the number of failed checks.
+ */
+
+#include <stddef.h>
+
+/* Records the size of every batch, then runs it in order */
+void ecs_test_parallel_for(size_t count, void (*job)(size_t index, void *data), void *data);
+#define ecs_parallel_for(count, job, data) ecs_test_parallel_for((count), (job), (data))
+
+/* Fails reallocations once test_realloc_left reaches 0, -1 never does */
+#include <stdlib.h>
+void *ecs_test_realloc(void *block, size_t size);
+#define ecs_malloc malloc
+#define ecs_realloc ecs_test_realloc
+#define ecs_free free
+
+#define ECS_IMPLEMENTATION
+#include "ecs.h"
+
+#include <stdio.h>
+
+#define ECS_TEST_CHECK(condition) \
+    do \
+    { \
+        if(!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++failed; \
+        } \
+    } while(0)
+
+#define ECS_TEST_COMPONENTS 1024
+
+size_t test_batches[8];
+size_t test_batches_count;
+
+void
+ecs_test_parallel_for(size_t count, void (*job)(size_t index, void *data), void *data)
+{
+    size_t i;
+
+    if(test_batches_count < 8)
+    {
+        test_batches[test_batches_count++] = count;
+    }
+
+    for(i = 0;
+        i < count;
+        ++i)
+    {
+        job(i, data);
+    }
+}
+
+int test_realloc_left = -1;
+
+void*
+ecs_test_realloc(void *block, size_t size)
+{
+    if(test_realloc_left == 0)
+    {
+        return(0);
+    }
+
+    if(test_realloc_left > 0)
+    {
+        --test_realloc_left;
+    }
+
+    return(realloc(block, size));
+}
+
+/* Masks span 16 words on 64-bit targets, detach must only clear its own bit */
+int
+test_wide_masks(void)
+{
+    size_t world, clone, entities[8], component_id, i, j;
+    ecs_query_result *result;
+    int failed;
+
+    failed = 0;
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+
+    /* Every third component is a tag */
+    for(i = 1;
+        i <= ECS_TEST_COMPONENTS;
+        ++i)
+    {
+        component_id = ecs_component_register((i % 3) ? sizeof(size_t) : 0);
+        ECS_TEST_CHECK(component_id == i);
+    }
+
+    /* Entity j has every component whose id is a multiple of j + 1 */
+    for(j = 0;
+        j < 8;
+        ++j)
+    {
+        entities[j] = ecs_entity_create();
+        for(i = 1;
+            i <= ECS_TEST_COMPONENTS;
+            ++i)
+        {
+            if(i % (j + 1) == 0)
+            {
+                ecs_entity_component_attach(entities[j], i);
+                if(i % 3)
+                {
+                    *(size_t *)ecs_entity_component_get(entities[j], i) = entities[j]*10000 + i;
+                }
+            }
+        }
+    }
+
+    for(j = 0;
+        j < 8;
+        ++j)
+    {
+        for(i = 1;
+            i <= ECS_TEST_COMPONENTS;
+            ++i)
+        {
+            ECS_TEST_CHECK(ecs_entity_component_has(entities[j], i) == (i % (j + 1) == 0));
+        }
+    }
+
+    /* The top bit of every word, then bits in the middle of the first words */
+    for(i = ECS_MASK_BITS;
+        i <= ECS_TEST_COMPONENTS;
+        i += ECS_MASK_BITS)
+    {
+        ecs_entity_component_detach(entities[0], i);
+    }
+
+    ecs_entity_component_detach(entities[0], 33);
+    ecs_entity_component_detach(entities[0], 65);
+
+    for(i = 1;
+        i <= ECS_TEST_COMPONENTS;
+        ++i)
+    {
+        ECS_TEST_CHECK(ecs_entity_component_has(entities[0], i) == (i % ECS_MASK_BITS != 0 && i != 33 && i != 65));
+    }
+
+    /* 1000 is a multiple of 1, 2, 4, 5 and 8, 1024 of 1, 2, 4 and 8 */
+    result = ecs_query(2, (size_t)1000, (size_t)1024);
+    ECS_TEST_CHECK(result && result->count == 3);
+
+    result = ecs_query(1, (size_t)1000);
+    ECS_TEST_CHECK(result && result->count == 5);
+
+    result = ecs_query(2, (size_t)65, (size_t)1);
+    ECS_TEST_CHECK(result && result->count == 0);
+
+    result = ecs_query(2, (size_t)1, (size_t)130);
+    ECS_TEST_CHECK(result && result->count == 1 && result->entities[0] == entities[0]);
+    if(result && result->count == 1)
+    {
+        ECS_TEST_CHECK(*(size_t *)ecs_query_get(result, 0, 1) == entities[0]*10000 + 130);
+    }
+
+    /* The clone sees the same masks and values */
+    clone = ecs_world_clone(world);
+    ECS_TEST_CHECK(clone != 0);
+    ecs_world_current_set(clone);
+
+    for(i = 1;
+        i <= ECS_TEST_COMPONENTS;
+        ++i)
+    {
+        ECS_TEST_CHECK(ecs_entity_component_has(entities[0], i) == (i % ECS_MASK_BITS != 0 && i != 33 && i != 65));
+    }
+
+    result = ecs_query(2, (size_t)1000, (size_t)1024);
+    ECS_TEST_CHECK(result && result->count == 3);
+    ECS_TEST_CHECK(*(size_t *)ecs_entity_component_get(entities[7], 1000) == entities[7]*10000 + 1000);
+
+    /* Changes to the clone stay in the clone */
+    ecs_entity_component_detach(entities[7], 1000);
+    result = ecs_query(1, (size_t)1000);
+    ECS_TEST_CHECK(result && result->count == 4);
+
+    ecs_world_current_set(world);
+    result = ecs_query(1, (size_t)1000);
+    ECS_TEST_CHECK(result && result->count == 5);
+
+    ecs_world_destroy(clone);
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+int
+test_mask_helpers(void)
+{
+    size_t words[3], full[2];
+    int failed;
+
+    failed = 0;
+
+    words[0] = 0;
+    words[1] = 0;
+    words[2] = (size_t)1 << 3;
+    ECS_TEST_CHECK(ecs_mask_next(words, 3, 0) == 2*ECS_MASK_BITS + 3);
+    ECS_TEST_CHECK(ecs_mask_next(words, 3, 2*ECS_MASK_BITS + 4) == ECS_MASK_END);
+    ECS_TEST_CHECK(ecs_mask_test(words, 3, 2*ECS_MASK_BITS + 3));
+    ECS_TEST_CHECK(!ecs_mask_test(words, 3, 5*ECS_MASK_BITS));
+
+    ecs_mask_clear(words, 3, 2*ECS_MASK_BITS + 3);
+    ECS_TEST_CHECK(ecs_mask_next(words, 3, 0) == ECS_MASK_END);
+
+    full[0] = 5;
+    full[1] = ~(size_t)0;
+    ECS_TEST_CHECK(ecs_mask_popcount(full, 2) == 2 + ECS_MASK_BITS);
+    ECS_TEST_CHECK(ecs_mask_word_full(full, 2, ECS_MASK_BITS));
+    ECS_TEST_CHECK(!ecs_mask_word_full(full, 2, 0));
+
+    return(failed);
+}
+
+/* Removal markers must not hide keys placed behind them */
+int
+test_map_churn(void)
+{
+    ecs_map map = {0};
+    size_t i, round;
+    int failed;
+
+    failed = 0;
+    for(round = 0;
+        round < 4;
+        ++round)
+    {
+        for(i = 0;
+            i < 1000;
+            ++i)
+        {
+            ecs_map_set(&map, i*ECS_MAP_MIN_CAP + round, i);
+        }
+
+        for(i = 0;
+            i < 1000;
+            i += 2)
+        {
+            ecs_map_unset(&map, i*ECS_MAP_MIN_CAP + round);
+        }
+    }
+
+    ECS_TEST_CHECK(map.count == 4*500);
+    for(i = 0;
+        i < 1000;
+        ++i)
+    {
+        ECS_TEST_CHECK((ecs_map_get(&map, i*ECS_MAP_MIN_CAP + 3) != 0) == (i % 2 == 1));
+    }
+
+    ecs_map_compact(&map);
+    ECS_TEST_CHECK(map.removed == 0 && map.count == 4*500);
+    ECS_TEST_CHECK(ecs_map_get(&map, 999*ECS_MAP_MIN_CAP + 2) && *ecs_map_get(&map, 999*ECS_MAP_MIN_CAP + 2) == 999);
+    ECS_TEST_CHECK(!ecs_map_get(&map, 998*ECS_MAP_MIN_CAP + 2));
+
+    ecs_map_free(&map);
+    ECS_TEST_CHECK(!ecs_map_get(&map, 1));
+
+    return(failed);
+}
+
+/* A unique key has one holder, a write of a taken key is undone. The bucket
+   table grows past its first size and shrinks back on compaction. */
+int
+test_key_collision(void)
+{
+    size_t world, component_id, index_id, team_index_id, first, second, count, i;
+    ecs_memory_stats before, after;
+    ecs_key_index *index;
+    unsigned key;
+    int failed;
+
+    failed = 0;
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+    component_id = ecs_component_register(2*sizeof(unsigned));
+    index_id = ecs_key_index_create(component_id, 0, sizeof(unsigned), 1);
+    team_index_id = ecs_key_index_create(component_id, sizeof(unsigned), sizeof(unsigned), 0);
+
+    key = 42;
+    first = ecs_entity_create();
+    second = ecs_entity_create();
+    ecs_entity_component_attach(first, component_id);
+    *(unsigned *)ecs_entity_component_get(first, component_id) = key;
+    ECS_TEST_CHECK(ecs_entity_component_modified(first, component_id));
+    ecs_entity_component_attach(second, component_id);
+    *(unsigned *)ecs_entity_component_get(second, component_id) = 7;
+    ECS_TEST_CHECK(ecs_entity_component_modified(second, component_id));
+    *(unsigned *)ecs_entity_component_get(second, component_id) = key;
+    ECS_TEST_CHECK(!ecs_entity_component_modified(second, component_id));
+
+    ECS_TEST_CHECK(*(unsigned *)ecs_entity_component_get(second, component_id) == 7);
+    ECS_TEST_CHECK(ecs_key_index_find(index_id, &key) == first);
+    ecs_key_index_find_all(index_id, &key, &count);
+    ECS_TEST_CHECK(count == 1);
+
+    /* Once first drops the key it is free again */
+    ecs_entity_component_detach(first, component_id);
+    ECS_TEST_CHECK(ecs_key_index_find(index_id, &key) == 0);
+    *(unsigned *)ecs_entity_component_get(second, component_id) = key;
+    ECS_TEST_CHECK(ecs_entity_component_modified(second, component_id));
+    ECS_TEST_CHECK(ecs_key_index_find(index_id, &key) == second);
+
+    /* The table grows with the keys, the non-unique index keeps every holder */
+    index = ecs_world_key_index_get(ecs_world_manager_get(&ecs_instance.world_manager, world), index_id);
+    ECS_TEST_CHECK(index->bucket_count == ECS_KEY_MIN_BUCKETS);
+    for(i = 0;
+        i < 1000;
+        ++i)
+    {
+        first = ecs_entity_create();
+        ecs_entity_component_attach(first, component_id);
+        ((unsigned *)ecs_entity_component_get(first, component_id))[0] = 1000 + (unsigned)i;
+        ((unsigned *)ecs_entity_component_get(first, component_id))[1] = (unsigned)i % 4;
+        ECS_TEST_CHECK(ecs_entity_component_modified(first, component_id));
+    }
+
+    key = 1;
+    ecs_key_index_find_all(team_index_id, &key, &count);
+    ECS_TEST_CHECK(count == 250);
+    key = 1999;
+    ECS_TEST_CHECK(ecs_key_index_find(index_id, &key) == first);
+    ECS_TEST_CHECK(index->bucket_count >= 1024 && index->count == 1001);
+
+    /* Stats follow the live bucket count */
+    ecs_world_memory_stats(world, &before);
+    for(i = 0;
+        i < 1000;
+        ++i)
+    {
+        ecs_entity_component_detach(first - i, component_id);
+    }
+
+    ecs_world_compact(world);
+    ecs_world_memory_stats(world, &after);
+    ECS_TEST_CHECK(index->bucket_count == ECS_KEY_MIN_BUCKETS);
+    ECS_TEST_CHECK(before.other - after.other >= 1000*sizeof(ecs_key_entry *));
+    key = 42;
+    ECS_TEST_CHECK(ecs_key_index_find(index_id, &key) == second);
+
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+/* Instances get consecutive ids and the prefab defaults */
+int
+test_instantiate(void)
+{
+    size_t world, component_id, tag_id, prefab_id, first, i;
+    ecs_query_result *result;
+    int failed;
+
+    failed = 0;
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+    component_id = ecs_component_register(sizeof(int));
+    tag_id = ecs_component_register(0);
+
+    prefab_id = ecs_prefab_create();
+    *(int *)ecs_prefab_component_attach(prefab_id, component_id) = 100;
+    ecs_prefab_component_attach(prefab_id, tag_id);
+
+    ecs_entity_create();
+    first = ecs_entity_instantiate(prefab_id, 20000);
+    ECS_TEST_CHECK(first == 2);
+
+    result = ecs_query(2, component_id, tag_id);
+    ECS_TEST_CHECK(result && result->count == 20000);
+    for(i = 0;
+        i < 20000;
+        ++i)
+    {
+        ECS_TEST_CHECK(ecs_entity_component_get(first + i, component_id) &&
+                       *(int *)ecs_entity_component_get(first + i, component_id) == 100);
+    }
+
+    ECS_TEST_CHECK(ecs_entity_create() == first + 20000);
+
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+/* Rows of the first component with the matching rows of the others */
+int
+test_component_rows(void)
+{
+    size_t world, ids[3], entities[6], *rows, count, i;
+    int failed;
+
+    failed = 0;
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+    ids[0] = ecs_component_register(sizeof(int));
+    ids[1] = ecs_component_register(sizeof(int));
+    ids[2] = ecs_component_register(0);
+
+    /* Every entity has the first component, entity i the second one at value i */
+    for(i = 0;
+        i < 6;
+        ++i)
+    {
+        entities[i] = ecs_entity_create();
+        ecs_entity_component_attach(entities[i], ids[0]);
+        *(int *)ecs_entity_component_get(entities[i], ids[0]) = (int)i;
+        if(i != 1)
+        {
+            ecs_entity_component_attach(entities[i], ids[1]);
+            *(int *)ecs_entity_component_get(entities[i], ids[1]) = 10 + (int)i;
+        }
+
+        ecs_entity_component_attach(entities[i], ids[2]);
+    }
+
+    /* Missing, disabled entity, disabled component, dead before the sync */
+    ecs_entity_enable(entities[2], 0);
+    ecs_entity_component_enable(entities[3], ids[1], 0);
+    ecs_entity_destroy(entities[4]);
+
+    rows = ecs_component_rows(ids, 3, &count);
+    ECS_TEST_CHECK(count == 2);
+    for(i = 0;
+        rows && i < count;
+        ++i)
+    {
+        int first, second;
+
+        first = ((int *)ecs_component_data(ids[0]))[rows[i*3]];
+        second = ((int *)ecs_component_data(ids[1]))[rows[i*3 + 1]];
+        ECS_TEST_CHECK(first == 0 || first == 5);
+        ECS_TEST_CHECK(second == 10 + first);
+        ECS_TEST_CHECK(rows[i*3 + 2] == 0);
+    }
+
+    rows = ecs_component_rows(ids, 1, &count);
+    ECS_TEST_CHECK(count == 4);
+
+    ECS_TEST_CHECK(!ecs_component_rows(ids + 2, 1, &count) && count == 0);
+
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+/* Destroyed entities leave the hierarchy before the sync and cannot be parented */
+int
+test_hierarchy_dead(void)
+{
+    size_t world, root, middle, leaf, other;
+    ecs_hierarchy_result *hierarchy;
+    int failed;
+
+    failed = 0;
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+
+    root = ecs_entity_create();
+    middle = ecs_entity_create();
+    leaf = ecs_entity_create();
+    other = ecs_entity_create();
+    ecs_entity_parent_set(middle, root);
+    ecs_entity_parent_set(leaf, middle);
+
+    hierarchy = ecs_hierarchy();
+    ECS_TEST_CHECK(hierarchy->count == 3);
+
+    /* The middle becomes a root once its parent is gone, the leaf follows it */
+    ecs_entity_destroy(root);
+    hierarchy = ecs_hierarchy();
+    ECS_TEST_CHECK(hierarchy->count == 2);
+    ECS_TEST_CHECK(hierarchy->entities[0] == middle && hierarchy->parents[0] == ECS_HIERARCHY_ROOT);
+    ECS_TEST_CHECK(hierarchy->entities[1] == leaf && hierarchy->parents[1] == 0);
+
+    ecs_entity_destroy(leaf);
+    hierarchy = ecs_hierarchy();
+    ECS_TEST_CHECK(hierarchy->count == 1 && hierarchy->entities[0] == middle);
+
+    ecs_entity_parent_set(other, leaf);
+    ecs_entity_parent_set(leaf, other);
+    ecs_entity_parent_set(other, 12345);
+    ECS_TEST_CHECK(ecs_entity_parent_get(other) == 0);
+    ECS_TEST_CHECK(ecs_entity_parent_get(leaf) == middle);
+
+    ecs_update();
+    hierarchy = ecs_hierarchy();
+    ECS_TEST_CHECK(hierarchy->count == 0);
+
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+/* Declared systems batch until a conflict, undeclared ones conflict with all */
+int test_system_order[8];
+size_t test_system_order_count;
+
+void
+test_system_record(float dt, void *user_data)
+{
+    (void)dt;
+    test_system_order[test_system_order_count++] = *(int *)user_data;
+}
+
+int
+test_system_access(void)
+{
+    size_t world, position, velocity, time_resource, systems[4], i;
+    int names[4], failed;
+
+    failed = 0;
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+    position = ecs_component_register(sizeof(float));
+    velocity = ecs_component_register(sizeof(float));
+    time_resource = ecs_resource_register(sizeof(float));
+
+    for(i = 0;
+        i < 4;
+        ++i)
+    {
+        names[i] = (int)i;
+        systems[i] = ecs_system_register(ECS_PHASE_UPDATE, test_system_record, 0.0f, &names[i]);
+    }
+
+    ECS_TEST_CHECK(ecs_system_component_access(systems[0], position, ECS_WRITE));
+    ECS_TEST_CHECK(ecs_system_component_access(systems[0], velocity, ECS_READ));
+    ECS_TEST_CHECK(ecs_system_resource_access(systems[0], time_resource, ECS_READ));
+    ECS_TEST_CHECK(ecs_system_component_access(systems[1], velocity, ECS_READ));
+    ECS_TEST_CHECK(ecs_system_resource_access(systems[1], time_resource, ECS_READ));
+    ECS_TEST_CHECK(ecs_system_component_access(systems[2], position, ECS_READ));
+
+    ECS_TEST_CHECK(!ecs_system_component_access(systems[3], 99, ECS_READ));
+    ECS_TEST_CHECK(!ecs_system_resource_access(systems[3], 99, ECS_READ));
+    ECS_TEST_CHECK(!ecs_system_component_access(99, position, ECS_READ));
+
+    /* The fixed step is the only rate of the fixed phase */
+    ECS_TEST_CHECK(!ecs_system_register(ECS_PHASE_FIXED, test_system_record, 30.0f, &names[0]));
+
+    /* Shared reads are fine, a write against a read is not */
+    ECS_TEST_CHECK(!ecs_system_conflicts(systems[0], systems[1]));
+    ECS_TEST_CHECK(ecs_system_conflicts(systems[0], systems[2]));
+    ECS_TEST_CHECK(!ecs_system_conflicts(systems[1], systems[2]));
+    ECS_TEST_CHECK(ecs_system_conflicts(systems[1], systems[3]));
+
+    /* Registration order survives the batching */
+    test_system_order_count = 0;
+    test_batches_count = 0;
+    ecs_progress(0.016f);
+    ECS_TEST_CHECK(test_batches_count == 2 && test_batches[0] == 2 && test_batches[1] == 1);
+    ECS_TEST_CHECK(test_system_order_count == 4);
+    for(i = 0;
+        i < test_system_order_count;
+        ++i)
+    {
+        ECS_TEST_CHECK(test_system_order[i] == (int)i);
+    }
+
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+/* A plain swap hands back the column from two updates ago, a refreshed one
+   keeps rows left untouched at the value they had */
+int
+test_double_buffer(void)
+{
+    size_t world, plain, refreshed, first, second;
+    int failed;
+
+    failed = 0;
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+    plain = ecs_component_register(sizeof(int));
+    refreshed = ecs_component_register(sizeof(int));
+    ECS_TEST_CHECK(ecs_component_double_buffer(plain));
+    ECS_TEST_CHECK(ecs_component_double_buffer_refresh(refreshed));
+
+    first = ecs_entity_create();
+    second = ecs_entity_create();
+    ecs_entity_component_attach(first, plain);
+    ecs_entity_component_attach(second, plain);
+    ecs_entity_component_attach(first, refreshed);
+    ecs_entity_component_attach(second, refreshed);
+    *(int *)ecs_entity_component_get(first, plain) = 1;
+    *(int *)ecs_entity_component_get(second, plain) = 2;
+    *(int *)ecs_entity_component_get(first, refreshed) = 1;
+    *(int *)ecs_entity_component_get(second, refreshed) = 2;
+    ecs_update();
+
+    /* The plain column is written in full */
+    ECS_TEST_CHECK(*(int *)ecs_entity_component_get(first, plain) == 0);
+    ECS_TEST_CHECK(*(int *)ecs_entity_component_get_prev(first, plain) == 1);
+    *(int *)ecs_entity_component_get(first, plain) = 3;
+    *(int *)ecs_entity_component_get(second, plain) = 4;
+
+    /* Only the first refreshed row is written */
+    *(int *)ecs_entity_component_get(first, refreshed) = 3;
+    ecs_update();
+
+    ECS_TEST_CHECK(*(int *)ecs_entity_component_get_prev(first, plain) == 3);
+    ECS_TEST_CHECK(*(int *)ecs_entity_component_get_prev(second, plain) == 4);
+    ECS_TEST_CHECK(*(int *)ecs_entity_component_get(first, plain) == 1);
+    ECS_TEST_CHECK(*(int *)ecs_entity_component_get(second, plain) == 2);
+
+    ECS_TEST_CHECK(*(int *)ecs_entity_component_get_prev(first, refreshed) == 3);
+    ECS_TEST_CHECK(*(int *)ecs_entity_component_get_prev(second, refreshed) == 2);
+    ECS_TEST_CHECK(*(int *)ecs_entity_component_get(first, refreshed) == 3);
+    ECS_TEST_CHECK(*(int *)ecs_entity_component_get(second, refreshed) == 2);
+
+    ecs_update();
+    ECS_TEST_CHECK(*(int *)ecs_entity_component_get(first, refreshed) == 3);
+
+    /* Refresh is kept by a clone */
+    ecs_world_current_set(ecs_world_clone(world));
+    *(int *)ecs_entity_component_get(first, refreshed) = 5;
+    ecs_update();
+    ECS_TEST_CHECK(*(int *)ecs_entity_component_get(first, refreshed) == 5);
+    ECS_TEST_CHECK(*(int *)ecs_entity_component_get(second, refreshed) == 2);
+    ecs_world_destroy(ecs_world_current_get());
+    ecs_world_current_set(world);
+
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+int
+test_int_compare(const void *a, const void *b)
+{
+    return((*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b));
+}
+
+/* Sorting moves rows with their entities, defragmenting restores id order in
+   lists that were not sorted */
+int
+test_sort_and_defragment(void)
+{
+    size_t world, component_id, other_id, entities[1000], *ids, count, i;
+    int *column, failed;
+
+    failed = 0;
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+    component_id = ecs_component_register(sizeof(int));
+    other_id = ecs_component_register(sizeof(int));
+
+    for(i = 0;
+        i < 1000;
+        ++i)
+    {
+        entities[i] = ecs_entity_create();
+        ecs_entity_component_attach(entities[i], component_id);
+        ecs_entity_component_attach(entities[i], other_id);
+        *(int *)ecs_entity_component_get(entities[i], component_id) = (int)((i*7919) % 1000);
+    }
+
+    for(i = 0;
+        i < 1000;
+        i += 3)
+    {
+        ecs_entity_destroy(entities[i]);
+    }
+
+    ecs_update();
+    ecs_component_sort(component_id, test_int_compare);
+
+    column = (int *)ecs_component_data(component_id);
+    count = ecs_component_count(component_id);
+    ECS_TEST_CHECK(count == 666);
+    for(i = 1;
+        i < count;
+        ++i)
+    {
+        ECS_TEST_CHECK(column[i - 1] <= column[i]);
+    }
+
+    ECS_TEST_CHECK(ecs_world_defragment(world));
+    column = (int *)ecs_component_data(component_id);
+    for(i = 1;
+        i < count;
+        ++i)
+    {
+        ECS_TEST_CHECK(column[i - 1] <= column[i]);
+    }
+
+    ids = ecs_component_entities(other_id);
+    ECS_TEST_CHECK(ecs_component_count(other_id) == count);
+    for(i = 1;
+        i < count;
+        ++i)
+    {
+        ECS_TEST_CHECK(ids[i - 1] < ids[i]);
+    }
+
+    for(i = 0;
+        i < 1000;
+        ++i)
+    {
+        if(i % 3)
+        {
+            ECS_TEST_CHECK(*(int *)ecs_entity_component_get(entities[i], component_id) == (int)((i*7919) % 1000));
+        }
+    }
+
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+/* Budgeted runs skip disabled words without visiting a slot twice */
+int
+test_query_budget(void)
+{
+    size_t world, component_id, query_id, entities[200], seen[200], total, memory, i, j;
+    ecs_query_result *result;
+    ecs_memory_stats before, after;
+    int failed;
+
+    failed = 0;
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+    component_id = ecs_component_register(sizeof(int));
+    query_id = ecs_query_create(1, component_id);
+
+    for(i = 0;
+        i < 200;
+        ++i)
+    {
+        entities[i] = ecs_entity_create();
+        ecs_entity_component_attach(entities[i], component_id);
+        seen[i] = 0;
+    }
+
+    memory = ecs_component_memory(component_id);
+    ecs_world_memory_stats(world, &before);
+
+    /* One full word of disabled slots, and one the cursor wraps onto */
+    for(i = 0;
+        i < 64;
+        ++i)
+    {
+        ecs_entity_enable(entities[64 + i], 0);
+        ecs_entity_enable(entities[i], 0);
+    }
+
+    result = ecs_query_run_budget(query_id, 30);
+    ECS_TEST_CHECK(result && result->count == 30);
+
+    /* From the cursor to the end and around, every live slot once */
+    result = ecs_query_run_budget(query_id, 1000);
+    ECS_TEST_CHECK(result && result->count == 72);
+    total = 0;
+    for(i = 0;
+        result && i < result->count;
+        ++i)
+    {
+        for(j = 0;
+            j < 200;
+            ++j)
+        {
+            if(entities[j] == result->entities[i])
+            {
+                ++seen[j];
+                ++total;
+            }
+        }
+    }
+
+    ECS_TEST_CHECK(total == 72);
+    for(j = 0;
+        j < 200;
+        ++j)
+    {
+        ECS_TEST_CHECK(seen[j] == (j >= 128));
+    }
+
+    /* The row bitmap grown by the disables counts in the world stats too */
+    ecs_world_memory_stats(world, &after);
+    ECS_TEST_CHECK(ecs_component_memory(component_id) > memory);
+    ECS_TEST_CHECK(after.components - before.components == ecs_component_memory(component_id) - memory);
+
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+/* A block that crosses the capacity is dropped whole and never read */
+int
+test_event_overflow(void)
+{
+    size_t world, channel_id, count, i;
+    int event, *block, *events;
+    int failed;
+
+    failed = 0;
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+    channel_id = ecs_event_channel_register(sizeof(int), 8);
+
+    block = (int *)ecs_event_reserve(channel_id, 5);
+    ECS_TEST_CHECK(block != 0);
+    for(i = 0;
+        block && i < 5;
+        ++i)
+    {
+        block[i] = (int)i;
+    }
+
+    /* Slots 5 to 7 are past the end of no reservation that fit */
+    ECS_TEST_CHECK(!ecs_event_reserve(channel_id, 4));
+    event = 9;
+    ECS_TEST_CHECK(!ecs_event_send(channel_id, &event));
+
+    events = (int *)ecs_event_read(channel_id, &count);
+    ECS_TEST_CHECK(count == 5);
+    for(i = 0;
+        events && i < count;
+        ++i)
+    {
+        ECS_TEST_CHECK(events[i] == (int)i);
+    }
+
+    /* The channel grew to the frame that overflowed */
+    ecs_update();
+    ECS_TEST_CHECK(!ecs_event_read(channel_id, &count) && count == 0);
+    ECS_TEST_CHECK(ecs_event_reserve(channel_id, 10) != 0);
+    ecs_event_read(channel_id, &count);
+    ECS_TEST_CHECK(count == 10);
+
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+/* Reserved ids are only handed out up to the reserved capacity */
+int
+test_reservation(void)
+{
+    size_t world, ids[5], i;
+    int failed;
+
+    failed = 0;
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+
+    ECS_TEST_CHECK(ecs_entity_reserve_capacity(4));
+    for(i = 0;
+        i < 5;
+        ++i)
+    {
+        ids[i] = ecs_entity_reserve();
+    }
+
+    ECS_TEST_CHECK(ids[4] == 0);
+    ECS_TEST_CHECK(ecs_entity_create() > ids[3]);
+
+    ecs_update();
+    for(i = 0;
+        i < 4;
+        ++i)
+    {
+        ECS_TEST_CHECK(ids[i] != 0);
+        ECS_TEST_CHECK(ecs_entity_enabled(ids[i]));
+    }
+
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+/* A snapshot followed by the journal started after it rebuilds the world */
+int
+test_journal_replay(void)
+{
+    size_t world, copy, component_id, first, second, third;
+    int failed;
+
+    failed = 0;
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+    component_id = ecs_component_register(sizeof(int));
+
+    first = ecs_entity_create();
+    second = ecs_entity_create();
+    ecs_entity_component_attach(first, component_id);
+    *(int *)ecs_entity_component_get(first, component_id) = 7;
+
+    ECS_TEST_CHECK(ecs_journal_snapshot("ecs_test.snapshot"));
+    ECS_TEST_CHECK(ecs_journal_open("ecs_test.journal"));
+
+    third = ecs_entity_create();
+    ecs_entity_component_attach(third, component_id);
+    *(int *)ecs_entity_component_get(third, component_id) = 9;
+    ecs_entity_component_modified(third, component_id);
+    ecs_entity_destroy(second);
+    ecs_update();
+    ECS_TEST_CHECK(ecs_journal_close());
+
+    copy = ecs_world_create();
+    ecs_world_current_set(copy);
+    ecs_component_register(sizeof(int));
+    ECS_TEST_CHECK(ecs_journal_replay("ecs_test.snapshot"));
+    ECS_TEST_CHECK(ecs_journal_replay("ecs_test.journal"));
+
+    ECS_TEST_CHECK(ecs_entity_enabled(first));
+    ECS_TEST_CHECK(!ecs_entity_enabled(second));
+    ECS_TEST_CHECK(ecs_entity_component_has(third, component_id));
+    ECS_TEST_CHECK(ecs_entity_component_get(first, component_id) &&
+                   *(int *)ecs_entity_component_get(first, component_id) == 7);
+    ECS_TEST_CHECK(ecs_entity_component_get(third, component_id) &&
+                   *(int *)ecs_entity_component_get(third, component_id) == 9);
+    ECS_TEST_CHECK(ecs_entity_create() > third);
+
+    remove("ecs_test.snapshot");
+    remove("ecs_test.journal");
+
+    ecs_world_destroy(copy);
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+/* Variable-size rows: resizing in and across slab classes, large blocks,
+   blocks released in bulk by ecs_update, and rows kept by clone and journal */
+int
+test_variable_components(void)
+{
+    size_t world, copy, component_id, first, second, large_bytes;
+    ecs_slab *slab;
+    ecs_blob *blob;
+    unsigned char *bytes, *moved, *reused;
+    int failed;
+
+    failed = 0;
+    ECS_TEST_CHECK(ecs_slab_class(1) == 0);
+    ECS_TEST_CHECK(ecs_slab_class(ECS_SLAB_MIN) == 0);
+    ECS_TEST_CHECK(ecs_slab_class(ECS_SLAB_MIN + 1) == 1);
+    ECS_TEST_CHECK(ecs_slab_class((size_t)ECS_SLAB_MIN << (ECS_SLAB_CLASSES - 1)) == ECS_SLAB_CLASSES - 1);
+    ECS_TEST_CHECK(ecs_slab_class(((size_t)ECS_SLAB_MIN << (ECS_SLAB_CLASSES - 1)) + 1) == ECS_SLAB_CLASSES);
+
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+    slab = &(ecs_world_manager_get(&ecs_instance.world_manager, world)->slab);
+    component_id = ecs_component_register_variable();
+    ECS_TEST_CHECK(component_id != 0);
+
+    first = ecs_entity_create();
+    second = ecs_entity_create();
+    ecs_entity_component_attach(first, component_id);
+    ecs_entity_component_attach(second, component_id);
+    blob = (ecs_blob *)ecs_entity_component_get(first, component_id);
+    ECS_TEST_CHECK(blob && !blob->data && blob->size == 0);
+
+    bytes = (unsigned char *)ecs_entity_component_resize(first, component_id, 5);
+    ECS_TEST_CHECK(bytes && bytes[4] == 0);
+    ecs_mem_copy("hello", bytes, 5);
+
+    /* Same class, the block stays and the new tail is zeroed */
+    ECS_TEST_CHECK(ecs_entity_component_resize(first, component_id, ECS_SLAB_MIN) == bytes);
+    ECS_TEST_CHECK(bytes[0] == 'h' && bytes[ECS_SLAB_MIN - 1] == 0);
+
+    /* Another class moves the bytes, the old block stays readable and out of
+       reach of new rows until ecs_update */
+    moved = (unsigned char *)ecs_entity_component_resize(first, component_id, 100);
+    ECS_TEST_CHECK(moved && moved != bytes && moved[4] == 'o' && moved[99] == 0);
+    ECS_TEST_CHECK(bytes[0] == 'h');
+    reused = (unsigned char *)ecs_entity_component_resize(second, component_id, ECS_SLAB_MIN);
+    ECS_TEST_CHECK(reused != bytes);
+    ecs_update();
+    ECS_TEST_CHECK(ecs_slab_alloc(slab, ECS_SLAB_MIN) == bytes);
+
+    /* Blocks past the largest class bypass the slabs, released ones are
+       freed in bulk by ecs_update as well */
+    large_bytes = slab->large_bytes;
+    bytes = (unsigned char *)ecs_entity_component_resize(second, component_id, 40000);
+    ECS_TEST_CHECK(bytes && bytes[39999] == 0 && slab->large_bytes == large_bytes + 40000);
+    ECS_TEST_CHECK(ecs_entity_component_resize(second, component_id, 3) != 0);
+    ECS_TEST_CHECK(slab->large_bytes == large_bytes + 40000 && slab->pending_count == 2);
+    ecs_update();
+    ECS_TEST_CHECK(slab->large_bytes == large_bytes && slab->pending_count == 0);
+
+    /* A clone copies the bytes into its own slab */
+    copy = ecs_world_clone(world);
+    ecs_world_current_set(copy);
+    blob = (ecs_blob *)ecs_entity_component_get(first, component_id);
+    ECS_TEST_CHECK(blob && blob->size == 100 && blob->data != moved &&
+                   ((unsigned char *)blob->data)[1] == 'e');
+    ecs_world_destroy(copy);
+    ecs_world_current_set(world);
+
+    /* Writes to variable rows are journaled with their size */
+    ECS_TEST_CHECK(ecs_journal_snapshot("ecs_test.snapshot"));
+    ECS_TEST_CHECK(ecs_journal_open("ecs_test.journal"));
+    bytes = (unsigned char *)ecs_entity_component_resize(second, component_id, 300);
+    bytes[299] = 9;
+    ecs_entity_component_modified(second, component_id);
+    ecs_entity_component_detach(first, component_id);
+    ecs_update();
+    ECS_TEST_CHECK(ecs_journal_close());
+
+    copy = ecs_world_create();
+    ecs_world_current_set(copy);
+    ecs_component_register_variable();
+    ECS_TEST_CHECK(ecs_journal_replay("ecs_test.snapshot"));
+    ECS_TEST_CHECK(ecs_journal_replay("ecs_test.journal"));
+    ECS_TEST_CHECK(!ecs_entity_component_has(first, component_id));
+    blob = (ecs_blob *)ecs_entity_component_get(second, component_id);
+    ECS_TEST_CHECK(blob && blob->size == 300 && ((unsigned char *)blob->data)[299] == 9);
+
+    remove("ecs_test.snapshot");
+    remove("ecs_test.journal");
+
+    ecs_world_destroy(copy);
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+typedef struct
+{
+    float x;
+    float y;
+} test_vec2;
+
+#define ECS_SCHEMA_NAME test_game
+#define ECS_SCHEMA(X)         \
+    X(position, test_vec2)    \
+    X(velocity, test_vec2)    \
+    X(health, int)
+#include "ecs_schema.h"
+
+/* Schema worlds: rows move on detach, ids are reused, queries walk the
+   smallest required column and a failed grow leaves the world usable */
+int
+test_schema(void)
+{
+    test_game_world world = {0};
+    size_t mask[test_game_mask_words] = {0};
+    size_t *entities, count, i, reused;
+    int failed;
+
+    failed = 0;
+    for(i = 0;
+        i < 64;
+        ++i)
+    {
+        ECS_TEST_CHECK(test_game_entity_create(&world) == i + 1);
+        test_game_position_attach(&world, i + 1)->x = (float)(i + 1);
+    }
+
+    ECS_TEST_CHECK(test_game_position_attach(&world, 5) == test_game_position_get(&world, 5));
+    ECS_TEST_CHECK(!test_game_position_attach(&world, 65));
+    test_game_velocity_attach(&world, 50)->x = 1.0f;
+    test_game_velocity_attach(&world, 10)->x = 2.0f;
+    *test_game_health_attach(&world, 20) = 3;
+    ECS_TEST_CHECK(test_game_entity_has(&world, 10, test_game_velocity_id));
+    ECS_TEST_CHECK(!test_game_entity_has(&world, 11, test_game_velocity_id));
+    ECS_TEST_CHECK(!test_game_entity_has(&world, 10, test_game_component_end));
+
+    /* The last row moves into the detached one */
+    test_game_position_detach(&world, 1);
+    ECS_TEST_CHECK(!test_game_position_get(&world, 1) && !test_game_entity_has(&world, 1, test_game_position_id));
+    ECS_TEST_CHECK(world.columns.position.count == 63 && world.columns.position.entities[0] == 64);
+    ECS_TEST_CHECK(test_game_position_get(&world, 64)->x == 64.0f);
+
+    /* Velocity has two rows, the results come in its row order */
+    ecs_schema_mask_set(mask, test_game_position_id);
+    ecs_schema_mask_set(mask, test_game_velocity_id);
+    entities = test_game_query(&world, mask, &count);
+    ECS_TEST_CHECK(count == 2 && entities[0] == 50 && entities[1] == 10);
+
+    /* Destroying detaches everything and the id comes back clean */
+    test_game_entity_destroy(&world, 50);
+    ECS_TEST_CHECK(!test_game_entity_alive(&world, 50) && !test_game_velocity_get(&world, 50));
+    entities = test_game_query(&world, mask, &count);
+    ECS_TEST_CHECK(count == 1 && entities[0] == 10);
+    reused = test_game_entity_create(&world);
+    ECS_TEST_CHECK(reused == 50);
+    ECS_TEST_CHECK(!test_game_entity_has(&world, 50, test_game_position_id) && !test_game_position_get(&world, 50));
+
+    /* An empty mask walks every live id */
+    ecs_mem_zero(mask, sizeof(mask));
+    test_game_entity_destroy(&world, 2);
+    entities = test_game_query(&world, mask, &count);
+    ECS_TEST_CHECK(count == 63 && entities[0] == 1 && entities[1] == 3);
+    ECS_TEST_CHECK(test_game_entity_create(&world) == 2);
+
+    /* The slots are full, the grow fails on the second column's rows */
+    test_realloc_left = 3;
+    ECS_TEST_CHECK(test_game_entity_create(&world) == 0);
+    test_realloc_left = -1;
+    ECS_TEST_CHECK(world.count == 64 && world.cap == 64);
+    ECS_TEST_CHECK(test_game_position_get(&world, 64)->x == 64.0f && *test_game_health_get(&world, 20) == 3);
+    ECS_TEST_CHECK(test_game_entity_create(&world) == 65);
+    ECS_TEST_CHECK(world.cap == 128 && !test_game_health_get(&world, 65) && !test_game_velocity_get(&world, 65));
+    ECS_TEST_CHECK(test_game_velocity_attach(&world, 65) && test_game_velocity_get(&world, 10)->x == 2.0f);
+
+    test_game_world_free(&world);
+
+    return(failed);
+}
+
+/* Ids are matched sorted and distinct, the result keeps the order asked
+   for. Row tables and per-row lookups resolve the same rows. */
+int
+test_query_columns(void)
+{
+    size_t world, copy, first_id, second_id, tag_id, query_id, entities[64], i;
+    ecs_query_signature *signature;
+    ecs_query_result *result;
+    int failed;
+
+    failed = 0;
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+    first_id = ecs_component_register(sizeof(int));
+    second_id = ecs_component_register(sizeof(double));
+    tag_id = ecs_component_register(0);
+
+    for(i = 0;
+        i < 64;
+        ++i)
+    {
+        entities[i] = ecs_entity_create();
+        ecs_entity_component_attach(entities[i], first_id);
+        ecs_entity_component_attach(entities[i], second_id);
+        *(int *)ecs_entity_component_get(entities[i], first_id) = (int)i;
+    }
+
+    ecs_entity_component_attach(entities[7], tag_id);
+    ecs_entity_component_attach(entities[40], tag_id);
+
+    query_id = ecs_query_create(4, second_id, tag_id, first_id, second_id);
+    signature = ecs_world_query_get(ecs_world_manager_get(&ecs_instance.world_manager, world), query_id);
+    ECS_TEST_CHECK(signature->components_count == 3 && signature->columns_count == 4);
+    ECS_TEST_CHECK(signature->components_ids[0] == first_id && signature->components_ids[2] == tag_id);
+
+    /* Two matches against 64 ids, rows are looked up in the maps */
+    result = ecs_query_run(query_id);
+    ECS_TEST_CHECK(result && result->count == 2 && result->components_count == 4);
+    ECS_TEST_CHECK(!signature->tables[0] && !signature->tables[1]);
+    ECS_TEST_CHECK(ecs_query_get(result, 1, 0) == ecs_entity_component_get(entities[40], second_id));
+    ECS_TEST_CHECK(ecs_query_get(result, 1, 1) == 0);
+    ECS_TEST_CHECK(*(int *)ecs_query_get(result, 1, 2) == 40);
+    ECS_TEST_CHECK(ecs_query_get(result, 1, 3) == ecs_query_get(result, 1, 0));
+
+    /* Every entity matches, rows come from the tables built for the run */
+    ecs_entity_component_detach(entities[3], first_id);
+    result = ecs_query(3, second_id, first_id, second_id);
+    signature = &(ecs_world_manager_get(&ecs_instance.world_manager, world)->query_signature);
+    ECS_TEST_CHECK(result && result->count == 63 && signature->tables[0] && signature->tables[1]);
+    for(i = 0;
+        i < result->count;
+        ++i)
+    {
+        ECS_TEST_CHECK(result->entities[i] != entities[3]);
+        ECS_TEST_CHECK(ecs_query_get(result, i, 0) == ecs_entity_component_get(result->entities[i], second_id));
+        ECS_TEST_CHECK(ecs_query_get(result, i, 1) == ecs_entity_component_get(result->entities[i], first_id));
+        ECS_TEST_CHECK(ecs_query_get(result, i, 2) == ecs_query_get(result, i, 0));
+    }
+
+    /* A clone keeps the column order */
+    copy = ecs_world_clone(world);
+    ecs_world_current_set(copy);
+    result = ecs_query_run(query_id);
+    ECS_TEST_CHECK(result && result->count == 2 && *(int *)ecs_query_get(result, 0, 2) == 7 &&
+                   ecs_query_get(result, 0, 1) == 0);
+    ecs_world_destroy(copy);
+    ecs_world_current_set(world);
+
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+#define TEST_SPATIAL_ENTITIES 300
+
+typedef struct
+{
+    float position[3];
+    int layer;
+} test_body;
+
+/* Brute force over every body, the query must return exactly these */
+int
+test_spatial_matches(
+    size_t *entities,
+    size_t component_id,
+    size_t dimensions,
+    float *min, float *max,
+    float *center, float radius,
+    size_t *results, size_t results_count)
+{
+    size_t i, j, expected;
+    int failed;
+
+    failed = 0;
+    expected = 0;
+    for(i = 0;
+        i < TEST_SPATIAL_ENTITIES;
+        ++i)
+    {
+        test_body *body;
+        float distance_squared;
+        int inside;
+
+        body = (test_body *)ecs_entity_component_get(entities[i], component_id);
+        if(!body)
+        {
+            continue;
+        }
+
+        inside = 1;
+        distance_squared = 0.0f;
+        for(j = 0;
+            j < dimensions;
+            ++j)
+        {
+            float d;
+
+            d = body->position[j] - (center ? center[j] : 0.0f);
+            distance_squared += d*d;
+            if(!center && (body->position[j] < min[j] || body->position[j] > max[j]))
+            {
+                inside = 0;
+            }
+        }
+
+        if(center)
+        {
+            inside = (distance_squared <= radius*radius);
+        }
+
+        if(!inside)
+        {
+            continue;
+        }
+
+        ++expected;
+        for(j = 0;
+            j < results_count;
+            ++j)
+        {
+            if(results[j] == entities[i])
+            {
+                break;
+            }
+        }
+
+        ECS_TEST_CHECK(j < results_count);
+    }
+
+    ECS_TEST_CHECK(results_count == expected);
+
+    return(failed);
+}
+
+int
+test_spatial_queries(size_t index_id, size_t *entities, size_t component_id, size_t dimensions)
+{
+    float min[3], max[3], center[3];
+    size_t *results, count, i;
+    int failed;
+
+    failed = 0;
+    for(i = 0;
+        i < 8;
+        ++i)
+    {
+        /* Centers on, next to and between cell boundaries of 4 */
+        center[0] = -8.0f + 2.5f*(float)i;
+        center[1] = 4.0f - 1.5f*(float)i;
+        center[2] = (i & 1) ? 0.0f : -4.0f;
+
+        results = ecs_spatial_query_radius(index_id, center[0], center[1], center[2], 3.0f + (float)i, &count);
+        failed += test_spatial_matches(entities, component_id, dimensions, 0, 0, center, 3.0f + (float)i,
+                                       results, count);
+
+        min[0] = center[0] - 1.0f;
+        min[1] = center[1] - 6.0f;
+        min[2] = center[2] - 0.5f;
+        max[0] = center[0] + 5.0f;
+        max[1] = center[1] + 0.25f;
+        max[2] = center[2] + 9.0f;
+        results = ecs_spatial_query_aabb(index_id, min[0], min[1], min[2], max[0], max[1], max[2], &count);
+        failed += test_spatial_matches(entities, component_id, dimensions, min, max, 0, 0.0f,
+                                       results, count);
+    }
+
+    /* More cells than buckets, every bucket is scanned once */
+    min[0] = min[1] = min[2] = -1.0e5f;
+    max[0] = max[1] = max[2] = 1.0e5f;
+    results = ecs_spatial_query_aabb(index_id, min[0], min[1], min[2], max[0], max[1], max[2], &count);
+    failed += test_spatial_matches(entities, component_id, dimensions, min, max, 0, 0.0f, results, count);
+
+    return(failed);
+}
+
+/* Radius and box queries across cell boundaries match a brute force scan,
+   before and after bodies move between cells, in 3 and 2 dimensions */
+int
+test_spatial_index(void)
+{
+    size_t world, component_id, grid_id, plane_id, entities[TEST_SPATIAL_ENTITIES], *results, count, i;
+    unsigned seed;
+    test_body *body;
+    int failed;
+
+    failed = 0;
+    grid_id = 0;
+    plane_id = 0;
+    world = ecs_world_create();
+    ecs_world_current_set(world);
+    component_id = ecs_component_register(sizeof(test_body));
+
+    ECS_TEST_CHECK(!ecs_spatial_index_create(component_id, 0, 4, 4.0f));
+    ECS_TEST_CHECK(!ecs_spatial_index_create(component_id, 0, 3, 0.0f));
+    ECS_TEST_CHECK(!ecs_spatial_index_create(component_id, 2*sizeof(float), 3, 4.0f));
+
+    /* Half the bodies exist before the indices and are picked up by them */
+    seed = 12345;
+    for(i = 0;
+        i < TEST_SPATIAL_ENTITIES;
+        ++i)
+    {
+        if(i == TEST_SPATIAL_ENTITIES/2)
+        {
+            grid_id = ecs_spatial_index_create(component_id, offsetof(test_body, position), 3, 4.0f);
+            plane_id = ecs_spatial_index_create(component_id, offsetof(test_body, position), 2, 4.0f);
+            ECS_TEST_CHECK(grid_id && plane_id);
+        }
+
+        entities[i] = ecs_entity_create();
+        ecs_entity_component_attach(entities[i], component_id);
+        body = (test_body *)ecs_entity_component_get(entities[i], component_id);
+        seed = seed*1103515245u + 12345u;
+        body->position[0] = (float)((seed >> 8) % 4000)/100.0f - 20.0f;
+        seed = seed*1103515245u + 12345u;
+        body->position[1] = (float)((seed >> 8) % 4000)/100.0f - 20.0f;
+        seed = seed*1103515245u + 12345u;
+        body->position[2] = (float)((seed >> 8) % 800)/100.0f - 4.0f;
+        ecs_entity_component_modified(entities[i], component_id);
+    }
+
+    failed += test_spatial_queries(grid_id, entities, component_id, 3);
+    failed += test_spatial_queries(plane_id, entities, component_id, 2);
+
+    /* Just below a cell boundary rounds down, also for negative values */
+    body = (test_body *)ecs_entity_component_get(entities[0], component_id);
+    body->position[0] = -0.001f;
+    body->position[1] = -4.0f;
+    body->position[2] = 3.999f;
+    ecs_entity_component_modified(entities[0], component_id);
+    results = ecs_spatial_query_aabb(grid_id, -0.002f, -4.0f, 3.999f, 0.0f, -4.0f, 4.0f, &count);
+    ECS_TEST_CHECK(count == 1 && results[0] == entities[0]);
+
+    /* Every body crosses at least one cell boundary, some stay put */
+    for(i = 0;
+        i < TEST_SPATIAL_ENTITIES;
+        ++i)
+    {
+        body = (test_body *)ecs_entity_component_get(entities[i], component_id);
+        body->position[0] += (i % 3 == 0) ? 0.5f : 4.0f*(float)(i % 5) - 8.0f;
+        body->position[1] -= (float)(i % 7);
+        ecs_entity_component_modified(entities[i], component_id);
+    }
+
+    failed += test_spatial_queries(grid_id, entities, component_id, 3);
+    failed += test_spatial_queries(plane_id, entities, component_id, 2);
+
+    /* Removed bodies leave both indices */
+    for(i = 0;
+        i < TEST_SPATIAL_ENTITIES;
+        i += 4)
+    {
+        if(i % 8)
+        {
+            ecs_entity_component_detach(entities[i], component_id);
+        }
+        else
+        {
+            ecs_entity_destroy(entities[i]);
+        }
+    }
+
+    ecs_update();
+    failed += test_spatial_queries(grid_id, entities, component_id, 3);
+    failed += test_spatial_queries(plane_id, entities, component_id, 2);
+
+    ecs_spatial_index_destroy(plane_id);
+    ecs_spatial_query_radius(plane_id, 0.0f, 0.0f, 0.0f, 100.0f, &count);
+    ECS_TEST_CHECK(count == 0);
+
+    ecs_world_destroy(world);
+    ecs_update();
+
+    return(failed);
+}
+
+int
+main(void)
+{
+    int failed;
+
+    failed = 0;
+    failed += test_wide_masks();
+    failed += test_mask_helpers();
+    failed += test_map_churn();
+    failed += test_key_collision();
+    failed += test_instantiate();
+    failed += test_component_rows();
+    failed += test_hierarchy_dead();
+    failed += test_system_access();
+    failed += test_double_buffer();
+    failed += test_sort_and_defragment();
+    failed += test_query_budget();
+    failed += test_event_overflow();
+    failed += test_reservation();
+    failed += test_journal_replay();
+    failed += test_variable_components();
+    failed += test_schema();
+    failed += test_query_columns();
+    failed += test_spatial_index();
+
+    if(failed)
+    {
+        fprintf(stderr, "%d checks failed\n", failed);
+        return(1);
+    }
+
+    printf("ok\n");
+
+    return(0);
+}